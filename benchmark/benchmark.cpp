@@ -0,0 +1,370 @@
+// Renders every scene under a directory at a reduced resolution and reports
+// the time taken and the work done. Results can be written to a JSON file
+// and compared against an earlier one to catch regressions.
+
+#include "sphere_scene.h"
+
+#include "primitive_arrays.h"
+#include "raytracer.h"
+#include "statistics.h"
+
+#include "json/json.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace
+{
+    struct Options
+    {
+        string scenes = "scenes";
+        string filter;          // only scenes whose path contains this
+        string output;          // JSON file to write the results to
+        string baseline;        // JSON file to compare the results with
+        string kernel;          // of PrimitiveArrays, the widest supported by default
+        unsigned spheres = 0;   // adds a generated scene with this many spheres
+        unsigned packetSize = 0;    // of the primary rays, 0 for that of the scene
+        unsigned size = 128;    // of the largest image dimension
+        unsigned seed = 1;
+        unsigned threads = 0;   // all hardware threads
+        unsigned repeat = 1;    // the fastest of the repetitions counts
+        double tolerance = 0.1;
+    };
+
+    struct Result
+    {
+        string scene;
+        unsigned width;
+        unsigned height;
+        double seconds;
+        Statistics statistics;
+
+        uint64_t rays() const
+        {
+            return statistics.primaryRays + statistics.secondaryRays + statistics.shadowRays;
+        }
+
+        double raysPerSecond() const
+        {
+            return rays() / seconds;
+        }
+
+        // Including the steps of the cone marches, which replace some of
+        // the steps of the rays.
+        double marchStepsPerRay() const
+        {
+            uint64_t steps = statistics.marchSteps + statistics.coneMarchSteps;
+            return rays() == 0 ? 0.0 : static_cast<double>(steps) / rays();
+        }
+    };
+
+    bool parseOptions(int argc, char *argv[], Options &options)
+    {
+        for (int idx = 1; idx < argc; ++idx)
+        {
+            string arg = argv[idx];
+            if (idx + 1 == argc)
+                return false;
+
+            string value = argv[++idx];
+            if (arg == "--scenes")
+                options.scenes = value;
+            else if (arg == "--filter")
+                options.filter = value;
+            else if (arg == "--output")
+                options.output = value;
+            else if (arg == "--baseline")
+                options.baseline = value;
+            else if (arg == "--size")
+                options.size = stoul(value);
+            else if (arg == "--seed")
+                options.seed = stoul(value);
+            else if (arg == "--threads")
+                options.threads = stoul(value);
+            else if (arg == "--repeat")
+                options.repeat = max(1ul, stoul(value));
+            else if (arg == "--tolerance")
+                options.tolerance = stod(value);
+            else if (arg == "--kernel")
+                options.kernel = value;
+            else if (arg == "--spheres")
+                options.spheres = stoul(value);
+            else if (arg == "--packet-size")
+                options.packetSize = stoul(value);
+            else
+                return false;
+        }
+        return options.size > 0 and options.packetSize != 3 and options.packetSize <= 4;
+    }
+
+    // Scene files relative to the scene directory, in a stable order.
+    vector<string> findScenes(Options const &options)
+    {
+        vector<string> scenes;
+        for (auto const &entry : filesystem::recursive_directory_iterator(options.scenes))
+        {
+            if (entry.path().extension() != ".json")
+                continue;
+
+            string scene = entry.path().lexically_relative(options.scenes).generic_string();
+            if (scene.find(options.filter) != string::npos)
+                scenes.push_back(scene);
+        }
+        sort(scenes.begin(), scenes.end());
+        return scenes;
+    }
+
+    bool run(Options const &options, string const &filename, string const &scene, Result &result)
+    {
+        Raytracer raytracer;
+
+        // The ray tracer reports its progress on cout, which would break up
+        // the table printed by the benchmark.
+        auto *coutBuffer = cout.rdbuf(nullptr);
+        bool ok = raytracer.readScene(filename);
+        cout.rdbuf(coutBuffer);
+        if (not ok)
+            return false;
+
+        // Keep the aspect ratio of the scene.
+        unsigned width = raytracer.getWidth();
+        unsigned height = raytracer.getHeight();
+        if (width >= height)
+            raytracer.setSize(options.size, max(1u, options.size * height / width));
+        else
+            raytracer.setSize(max(1u, options.size * width / height), options.size);
+
+        raytracer.setSeed(options.seed);
+        raytracer.setThreadCount(options.threads);
+        if (options.packetSize > 0)
+            raytracer.setPacketSize(options.packetSize);
+
+        result.scene = scene;
+        result.width = raytracer.getWidth();
+        result.height = raytracer.getHeight();
+        result.seconds = numeric_limits<double>::infinity();
+        for (unsigned repetition = 0; repetition != options.repeat; ++repetition)
+        {
+            auto start = chrono::steady_clock::now();
+            raytracer.render();
+            chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+            result.seconds = min(result.seconds, elapsed.count());
+        }
+
+        // The counters do not depend on the repetition.
+        result.statistics = raytracer.getStatistics();
+        return true;
+    }
+
+    json toJson(Options const &options, vector<Result> const &results)
+    {
+        json scenes = json::array();
+        for (Result const &result : results)
+        {
+            scenes.push_back({
+                {"scene", result.scene},
+                {"width", result.width},
+                {"height", result.height},
+                {"seconds", result.seconds},
+                {"raysPerSecond", result.raysPerSecond()},
+                {"primaryRays", result.statistics.primaryRays},
+                {"secondaryRays", result.statistics.secondaryRays},
+                {"shadowRays", result.statistics.shadowRays},
+                {"marchSteps", result.statistics.marchSteps},
+                {"coneMarchSteps", result.statistics.coneMarchSteps},
+                {"marchStepsPerRay", result.marchStepsPerRay()}
+            });
+        }
+
+        return json{
+            {"size", options.size},
+            {"seed", options.seed},
+            {"threads", options.threads},
+            {"repeat", options.repeat},
+            {"kernel", PrimitiveArrays::kernelName(PrimitiveArrays::kernel())},
+            {"packetSize", options.packetSize},
+            {"scenes", scenes}
+        };
+    }
+
+    // Prints the scenes that got slower or needed more march steps per ray
+    // than in the baseline, and returns how many did.
+    unsigned compare(Options const &options, vector<Result> const &results, json const &baseline)
+    {
+        unsigned regressions = 0;
+        for (Result const &result : results)
+        {
+            auto entry = find_if(baseline["scenes"].begin(), baseline["scenes"].end(),
+                                 [&](json const &node)
+                                 {
+                                     return node["scene"] == result.scene
+                                        and node["width"] == result.width
+                                        and node["height"] == result.height;
+                                 });
+            if (entry == baseline["scenes"].end())
+            {
+                cout << result.scene << ": not in the baseline\n";
+                continue;
+            }
+
+            double seconds = (*entry)["seconds"];
+            double marchStepsPerRay = (*entry)["marchStepsPerRay"];
+            uint64_t rays = (*entry)["primaryRays"].get<uint64_t>()
+                          + (*entry)["secondaryRays"].get<uint64_t>()
+                          + (*entry)["shadowRays"].get<uint64_t>();
+
+            bool slower = result.seconds > (1.0 + options.tolerance) * seconds;
+            bool moreSteps = result.marchStepsPerRay() > (1.0 + options.tolerance) * marchStepsPerRay;
+            if (slower or moreSteps)
+                ++regressions;
+
+            if (slower)
+                cout << "REGRESSION " << result.scene << ": " << result.seconds
+                     << " s, was " << seconds << " s\n";
+            if (moreSteps)
+                cout << "REGRESSION " << result.scene << ": " << result.marchStepsPerRay()
+                     << " march steps per ray, was " << marchStepsPerRay << '\n';
+
+            // Not a regression in itself, but the images are likely different.
+            if (rays != result.rays())
+                cout << "NOTE " << result.scene << ": " << result.rays()
+                     << " rays, was " << rays << '\n';
+        }
+        return regressions;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (not parseOptions(argc, argv, options))
+    {
+        cerr << "Usage: " << argv[0] << " [--scenes DIR] [--filter TEXT] [--size N]"
+                " [--seed N] [--threads N] [--repeat N] [--output FILE.json]"
+                " [--baseline FILE.json] [--tolerance FRACTION] [--kernel scalar|sse4|avx2]"
+                " [--spheres N] [--packet-size 1|2|4]\n";
+        return 1;
+    }
+
+    if (not options.kernel.empty())
+    {
+        PrimitiveArrays::Kernel kernel;
+        if (not PrimitiveArrays::parseKernel(options.kernel, kernel))
+        {
+            cerr << "Error: unknown kernel " << options.kernel << ".\n";
+            return 1;
+        }
+        if (not PrimitiveArrays::setKernel(kernel))
+        {
+            cerr << "Error: the CPU does not support the " << options.kernel << " kernel.\n";
+            return 1;
+        }
+    }
+
+#ifndef __OPTIMIZE__
+    cerr << "Warning: the benchmark was built without optimizations, "
+            "configure with -DCMAKE_BUILD_TYPE=Release.\n";
+#endif
+
+    json baseline;
+    if (not options.baseline.empty())
+    {
+        ifstream file(options.baseline);
+        if (not file)
+        {
+            cerr << "Error: could not open " << options.baseline << ".\n";
+            return 1;
+        }
+        file >> baseline;
+        if (baseline.count("scenes") == 0)
+        {
+            cerr << "Error: " << options.baseline << " is not a benchmark result.\n";
+            return 1;
+        }
+    }
+
+    // Scene names with their files.
+    vector<pair<string, string>> scenes;
+    try
+    {
+        for (string const &scene : findScenes(options))
+            scenes.emplace_back(scene, options.scenes + "/" + scene);
+    }
+    catch (filesystem::filesystem_error const &error)
+    {
+        cerr << "Error: " << error.what() << '\n';
+        return 1;
+    }
+
+    string generated;
+    if (options.spheres > 0)
+    {
+        string scene = "generated/spheres_" + to_string(options.spheres);
+        if (scene.find(options.filter) != string::npos)
+        {
+            generated = writeSphereScene(options.spheres);
+            scenes.emplace_back(scene, generated);
+        }
+    }
+
+    cout << "Intersection kernel: " << PrimitiveArrays::kernelName(PrimitiveArrays::kernel()) << '\n';
+    printf("%-64s %9s %9s %10s %10s %10s %10s %10s\n", "scene", "size", "seconds",
+           "Mrays/s", "primary", "secondary", "shadow", "steps/ray");
+
+    vector<Result> results;
+    for (auto const &entry : scenes)
+    {
+        string const &scene = entry.first;
+        Result result;
+        if (not run(options, entry.second, scene, result))
+        {
+            cerr << "Error: could not read " << scene << ", skipped.\n";
+            continue;
+        }
+
+        string size = to_string(result.width) + "x" + to_string(result.height);
+        printf("%-64s %9s %9.3f %10.3f %10lu %10lu %10lu %10.2f\n", scene.c_str(), size.c_str(),
+               result.seconds, result.raysPerSecond() / 1E6,
+               static_cast<unsigned long>(result.statistics.primaryRays),
+               static_cast<unsigned long>(result.statistics.secondaryRays),
+               static_cast<unsigned long>(result.statistics.shadowRays),
+               result.marchStepsPerRay());
+        fflush(stdout);
+
+        results.push_back(result);
+    }
+
+    if (not generated.empty())
+        filesystem::remove(generated);
+
+    if (not options.output.empty())
+    {
+        ofstream file(options.output);
+        file << toJson(options, results).dump(4) << '\n';
+        if (not file)
+        {
+            cerr << "Error: could not write " << options.output << ".\n";
+            return 1;
+        }
+    }
+
+    if (not options.baseline.empty())
+    {
+        unsigned regressions = compare(options, results, baseline);
+        cout << regressions << " regression(s) beyond " << 100.0 * options.tolerance << "%.\n";
+        if (regressions > 0)
+            return 2;
+    }
+
+    return 0;
+}
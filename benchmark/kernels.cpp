@@ -0,0 +1,211 @@
+// Compares the intersection kernels of PrimitiveArrays with each other and
+// with the virtual Sphere::intersect on generated scenes of spheres: first
+// one ray against a few packed spheres, then a whole render. Built without
+// the render statistics, whose counters would cost more than the tests.
+
+#include "sphere_scene.h"
+
+#include "primitive_arrays.h"
+#include "raytracer.h"
+#include "shapes/sphere.h"
+
+#include "json/json.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace
+{
+    struct Options
+    {
+        unsigned spheres = 100000;  // of the rendered scene
+        unsigned size = 512;        // of the rendered image
+        unsigned threads = 1;
+        unsigned repeat = 3;        // the fastest of the repetitions counts
+    };
+
+    bool parseOptions(int argc, char *argv[], Options &options)
+    {
+        for (int idx = 1; idx < argc; ++idx)
+        {
+            string arg = argv[idx];
+            if (idx + 1 == argc)
+                return false;
+
+            string value = argv[++idx];
+            if (arg == "--spheres")
+                options.spheres = stoul(value);
+            else if (arg == "--size")
+                options.size = stoul(value);
+            else if (arg == "--threads")
+                options.threads = stoul(value);
+            else if (arg == "--repeat")
+                options.repeat = max(1ul, stoul(value));
+            else
+                return false;
+        }
+        return options.spheres > 0 and options.size > 0;
+    }
+
+    vector<PrimitiveArrays::Kernel> supportedKernels()
+    {
+        vector<PrimitiveArrays::Kernel> kernels;
+        PrimitiveArrays::Kernel selected = PrimitiveArrays::kernel();
+        for (PrimitiveArrays::Kernel kernel : {PrimitiveArrays::Kernel::Scalar,
+                                               PrimitiveArrays::Kernel::Sse4,
+                                               PrimitiveArrays::Kernel::Avx2})
+        {
+            if (PrimitiveArrays::setKernel(kernel))
+                kernels.push_back(kernel);
+        }
+        PrimitiveArrays::setKernel(selected);
+        return kernels;
+    }
+
+    // Repeats closest(ray) for all rays for at least 0.2 s. Returns the
+    // nanoseconds per sphere test, and counts the rays that hit.
+    template <typename Closest>
+    double timeTests(vector<Ray> const &rays, unsigned count, Closest const &closest, unsigned &hits)
+    {
+        uint64_t tests = 0;
+        auto start = chrono::steady_clock::now();
+        chrono::duration<double> elapsed(0.0);
+        while (elapsed.count() < 0.2)
+        {
+            hits = 0;
+            for (Ray const &ray : rays)
+                hits += isfinite(closest(ray));
+            tests += static_cast<uint64_t>(rays.size()) * count;
+            elapsed = chrono::steady_clock::now() - start;
+        }
+        return 1E9 * elapsed.count() / tests;
+    }
+
+    // One ray against the spheres of sphereScene(count), all of them packed
+    // in one array, as in a leaf of the hierarchy or a scene without one.
+    void timeSphereTests(unsigned count, vector<PrimitiveArrays::Kernel> const &kernels)
+    {
+        json scene = sphereScene(count);
+        PrimitiveArrays spheres;
+        vector<ObjectPtr> objects;
+        for (json const &node : scene["Objects"])
+        {
+            Point position(node["position"][0], node["position"][1], node["position"][2]);
+            objects.push_back(make_shared<Sphere>(position, node["radius"].get<double>()));
+            spheres.add(objects.back());
+        }
+
+        // Aimed at the volume of the spheres, so that some of them hit.
+        mt19937 engine(1);
+        uniform_real_distribution<double> position(-4.0, 4.0);
+        uniform_real_distribution<double> depth(-12.0, -4.0);
+        Point eye(0.0, 0.0, 4.0);
+        vector<Ray> rays;
+        for (unsigned idx = 0; idx != 1024; ++idx)
+        {
+            Point target(position(engine), position(engine), depth(engine));
+            rays.emplace_back(eye, (target - eye).normalized());
+        }
+
+        unsigned hits;
+        double virtualCall = timeTests(rays, count, [&](Ray const &ray)
+        {
+            double t = numeric_limits<double>::infinity();
+            for (ObjectPtr const &obj : objects)
+                t = min(t, obj->intersect(ray).t);      // a miss is NaN
+            return t;
+        }, hits);
+        printf("%10u %10u %10.2f", count, hits, virtualCall);
+
+        PrimitiveArrays::Kernel selected = PrimitiveArrays::kernel();
+        for (PrimitiveArrays::Kernel kernel : kernels)
+        {
+            PrimitiveArrays::setKernel(kernel);
+            double packed = timeTests(rays, count, [&](Ray const &ray)
+            {
+                double t = numeric_limits<double>::infinity();
+                spheres.closestSphere(ray, 0, count, t);
+                return t;
+            }, hits);
+            printf(" %10.2f", packed);
+        }
+        PrimitiveArrays::setKernel(selected);
+        printf("\n");
+    }
+
+    // Seconds to render the scene, the fastest of the repetitions.
+    double timeRender(Options const &options, string const &filename)
+    {
+        Raytracer raytracer;
+
+        // The ray tracer reports its progress on cout.
+        auto *coutBuffer = cout.rdbuf(nullptr);
+        bool ok = raytracer.readScene(filename);
+        cout.rdbuf(coutBuffer);
+        if (not ok)
+            return numeric_limits<double>::quiet_NaN();
+
+        raytracer.setSize(options.size, options.size);
+        raytracer.setSeed(1);
+        raytracer.setThreadCount(options.threads);
+
+        double seconds = numeric_limits<double>::infinity();
+        for (unsigned repetition = 0; repetition != options.repeat; ++repetition)
+        {
+            auto start = chrono::steady_clock::now();
+            raytracer.render();
+            chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+            seconds = min(seconds, elapsed.count());
+        }
+        return seconds;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (not parseOptions(argc, argv, options))
+    {
+        cerr << "Usage: " << argv[0] << " [--spheres N] [--size N] [--threads N] [--repeat N]\n";
+        return 1;
+    }
+
+#ifndef __OPTIMIZE__
+    cerr << "Warning: the kernel benchmark was built without optimizations, "
+            "configure with -DCMAKE_BUILD_TYPE=Release.\n";
+#endif
+
+    vector<PrimitiveArrays::Kernel> kernels = supportedKernels();
+
+    cout << "Nanoseconds per sphere test, one ray against packed spheres:\n";
+    printf("%10s %10s %10s", "spheres", "hits", "virtual");
+    for (PrimitiveArrays::Kernel kernel : kernels)
+        printf(" %10s", PrimitiveArrays::kernelName(kernel).c_str());
+    printf("\n");
+    for (unsigned count : {8u, 64u})
+        timeSphereTests(count, kernels);
+
+    cout << "\nSeconds to render " << options.spheres << " spheres at " << options.size
+         << "x" << options.size << " on " << options.threads << " threads:\n";
+    string filename = writeSphereScene(options.spheres);
+    PrimitiveArrays::Kernel selected = PrimitiveArrays::kernel();
+    for (PrimitiveArrays::Kernel kernel : kernels)
+    {
+        PrimitiveArrays::setKernel(kernel);
+        printf("%10s %10.3f\n", PrimitiveArrays::kernelName(kernel).c_str(), timeRender(options, filename));
+    }
+    PrimitiveArrays::setKernel(selected);
+    filesystem::remove(filename);
+}
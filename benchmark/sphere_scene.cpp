@@ -0,0 +1,52 @@
+#include "sphere_scene.h"
+
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+using namespace std;
+using json = nlohmann::json;
+
+json sphereScene(unsigned count)
+{
+    mt19937 engine(count);
+    uniform_real_distribution<double> position(-4.0, 4.0);
+    uniform_real_distribution<double> depth(-12.0, -4.0);
+    uniform_real_distribution<double> channel(0.2, 1.0);
+
+    // Keeps the volume filled by the spheres about the same.
+    double radius = 2.0 / cbrt(count);
+
+    json objects = json::array();
+    for (unsigned idx = 0; idx != count; ++idx)
+    {
+        objects.push_back({
+            {"type", "sphere"},
+            {"position", {position(engine), position(engine), depth(engine)}},
+            {"radius", radius},
+            {"material", {
+                {"color", {channel(engine), channel(engine), channel(engine)}},
+                {"ka", 0.2}, {"kd", 0.7}, {"ks", 0.5}, {"n", 32}
+            }}
+        });
+    }
+
+    return json{
+        {"Eye", {0, 0, 4}},
+        {"FieldOfView", 60},
+        {"Shadows", true},
+        {"Lights", {{{"position", {-10, 10, 10}}, {"color", {0.8, 0.8, 0.8}}}}},
+        {"Objects", objects},
+        {"Width", 512},
+        {"Height", 512}
+    };
+}
+
+string writeSphereScene(unsigned count)
+{
+    string filename = (filesystem::temp_directory_path()
+                       / ("spheres_" + to_string(count) + ".json")).string();
+    ofstream(filename) << sphereScene(count).dump();
+    return filename;
+}
@@ -0,0 +1,16 @@
+#ifndef SPHERE_SCENE_H_
+#define SPHERE_SCENE_H_
+
+#include "json/json.h"
+
+#include <string>
+
+// Scene of count randomly placed spheres, for the intersection kernels and
+// the hierarchy. The same count always gives the same scene.
+nlohmann::json sphereScene(unsigned count);
+
+// Writes sphereScene(count) to the temporary directory and returns its
+// file name.
+std::string writeSphereScene(unsigned count);
+
+#endif
@@ -0,0 +1,51 @@
+#include "band_writer.h"
+
+#include <algorithm>
+
+using namespace std;
+
+BandWriter::BandWriter(string const &filename, Framebuffer const &img,
+                       vector<Tile> const &tiles, unsigned tileSize)
+:
+    d_img(img),
+    d_png(filename, img.width(), img.height(), 1),   // the other threads are rendering
+    d_tileSize(max(tileSize, 1u)),      // as in TileScheduler
+    d_remaining((img.height() + d_tileSize - 1) / d_tileSize, 0),
+    d_row(img.width())
+{
+    for (Tile const &tile : tiles)
+        ++d_remaining[tile.y0 / d_tileSize];
+}
+
+void BandWriter::finish(Tile const &tile)
+{
+    unique_lock<mutex> lock(d_mutex);
+    --d_remaining[tile.y0 / d_tileSize];
+    if (d_writing)
+        return;
+
+    // The lock is released while writing, so that other threads can mark
+    // their tiles meanwhile.
+    d_writing = true;
+    while (d_nextBand != d_remaining.size() and d_remaining[d_nextBand] == 0)
+    {
+        unsigned band = d_nextBand++;
+        lock.unlock();
+
+        unsigned end = min((band + 1) * d_tileSize, d_img.height());
+        for (unsigned y = band * d_tileSize; y != end; ++y)
+        {
+            d_img.getRow(y, d_row.data());
+            d_png.writeRow(d_row.data());
+        }
+
+        lock.lock();
+    }
+    d_writing = false;
+}
+
+bool BandWriter::close()
+{
+    lock_guard<mutex> lock(d_mutex);
+    return d_png.finish();
+}
@@ -0,0 +1,48 @@
+#ifndef BAND_WRITER_H_
+#define BAND_WRITER_H_
+
+#include "framebuffer.h"
+#include "png_writer.h"
+#include "tile_scheduler.h"
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Writes a framebuffer to a PNG file while it is being rendered. The rows
+// of the image are written in bands, one per row of tiles, as soon as all
+// tiles of the band and of the bands above it are finished. Encoding thereby
+// overlaps with rendering the rest of the image, and only a row of the image
+// is converted at a time.
+//
+// The thread that finishes a tile encodes the bands that became ready, while
+// the other threads continue rendering. Tiles finishing meanwhile are picked
+// up by that same thread, so at most one thread encodes at any time. It also
+// compresses alone, without the threads of PngWriter, as all the others are
+// busy rendering.
+class BandWriter
+{
+    Framebuffer const &d_img;
+    PngWriter d_png;
+    unsigned d_tileSize;
+    std::vector<unsigned> d_remaining;  // unfinished tiles per band
+    unsigned d_nextBand = 0;            // to be written
+    bool d_writing = false;
+    std::vector<Color> d_row;
+    std::mutex d_mutex;
+
+    public:
+        // The tiles as given by a TileScheduler for the image and tile size.
+        BandWriter(std::string const &filename, Framebuffer const &img,
+                   std::vector<Tile> const &tiles, unsigned tileSize);
+
+        // Marks the tile as finished and writes the bands that are complete.
+        // Safe to call from the worker threads.
+        void finish(Tile const &tile);
+
+        // Ends the file, once all tiles are finished. Returns false if it
+        // could not be written.
+        bool close();
+};
+
+#endif
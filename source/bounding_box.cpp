@@ -0,0 +1,107 @@
+#include "bounding_box.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+using namespace std;
+
+BoundingBox::BoundingBox()
+:
+    lower(numeric_limits<double>::infinity(),
+          numeric_limits<double>::infinity(),
+          numeric_limits<double>::infinity()),
+    upper(-numeric_limits<double>::infinity(),
+          -numeric_limits<double>::infinity(),
+          -numeric_limits<double>::infinity())
+{}
+
+BoundingBox::BoundingBox(Point const &lower, Point const &upper)
+:
+    lower(lower),
+    upper(upper)
+{}
+
+BoundingBox const BoundingBox::UNBOUNDED()
+{
+    static BoundingBox unbounded(Point(-numeric_limits<double>::infinity(),
+                                       -numeric_limits<double>::infinity(),
+                                       -numeric_limits<double>::infinity()),
+                                 Point(numeric_limits<double>::infinity(),
+                                       numeric_limits<double>::infinity(),
+                                       numeric_limits<double>::infinity()));
+    return unbounded;
+}
+
+bool BoundingBox::isBounded() const
+{
+    for (unsigned axis = 0; axis != 3; ++axis)
+        if (not isfinite(lower.data[axis]) or not isfinite(upper.data[axis]))
+            return false;
+    return true;
+}
+
+bool BoundingBox::isEmpty() const
+{
+    return lower.x > upper.x or lower.y > upper.y or lower.z > upper.z;
+}
+
+void BoundingBox::extend(Point const &point)
+{
+    for (unsigned axis = 0; axis != 3; ++axis)
+    {
+        lower.data[axis] = min(lower.data[axis], point.data[axis]);
+        upper.data[axis] = max(upper.data[axis], point.data[axis]);
+    }
+}
+
+void BoundingBox::extend(BoundingBox const &box)
+{
+    extend(box.lower);
+    extend(box.upper);
+}
+
+Point BoundingBox::center() const
+{
+    return 0.5 * (lower + upper);
+}
+
+double BoundingBox::surfaceArea() const
+{
+    if (isEmpty())
+        return 0.0;
+
+    Vector extent = upper - lower;
+    return 2.0 * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+unsigned BoundingBox::largestAxis() const
+{
+    Vector extent = upper - lower;
+    if (extent.x >= extent.y and extent.x >= extent.z)
+        return 0;
+    return extent.y >= extent.z ? 1 : 2;
+}
+
+// Slab test: intersect the ray with the three pairs of axis aligned planes.
+bool BoundingBox::intersect(Ray const &ray, double &tNear, double &tFar) const
+{
+    tNear = 0.0;
+    tFar = numeric_limits<double>::infinity();
+    for (unsigned axis = 0; axis != 3; ++axis)
+    {
+        double inverse = 1.0 / ray.D.data[axis];
+        double t0 = (lower.data[axis] - ray.O.data[axis]) * inverse;
+        double t1 = (upper.data[axis] - ray.O.data[axis]) * inverse;
+        if (t0 > t1)
+            swap(t0, t1);
+
+        // Written so that NaNs (ray parallel to and inside a slab) are ignored.
+        tNear = t0 > tNear ? t0 : tNear;
+        tFar = t1 < tFar ? t1 : tFar;
+        if (tNear > tFar)
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,35 @@
+#ifndef BOUNDING_BOX_H_
+#define BOUNDING_BOX_H_
+
+#include "ray.h"
+#include "triple.h"
+
+// Axis aligned bounding box. A default constructed box is empty and
+// grows by extending it with points or other boxes.
+class BoundingBox
+{
+    public:
+        Point lower;
+        Point upper;
+
+        BoundingBox();
+        BoundingBox(Point const &lower, Point const &upper);
+
+        // Box of objects without finite extent, such as infinitely repeated shapes.
+        static BoundingBox const UNBOUNDED();
+
+        bool isBounded() const;
+        bool isEmpty() const;
+
+        void extend(Point const &point);
+        void extend(BoundingBox const &box);
+
+        Point center() const;
+        double surfaceArea() const;
+        unsigned largestAxis() const;   // 0, 1 or 2 for x, y or z
+
+        // Parametric interval [tNear, tFar] in which the ray is inside the box.
+        bool intersect(Ray const &ray, double &tNear, double &tFar) const;
+};
+
+#endif
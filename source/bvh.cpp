@@ -0,0 +1,577 @@
+#include "bvh.h"
+
+#include "simd.h"
+#include "statistics.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+namespace
+{
+    size_t const maxLeafSize = 4;
+    size_t const binCount = 12;
+
+    // Deeper subtrees are split at the median, which bounds the traversal
+    // stack even for pathological object distributions.
+    unsigned const maxSahDepth = 48;
+
+    // Levels of the tree, and so the size of the traversal stacks, which
+    // hold at most one node per level. The heuristic is only used while the
+    // children, which may keep all but one object, can still reach their
+    // leaves with median splits within this depth.
+    unsigned const maxDepth = 64;
+
+    // Levels that median splits take to reduce count objects to leaves.
+    unsigned medianDepth(size_t count)
+    {
+        unsigned levels = 0;
+        for (; count > maxLeafSize; count = (count + 1) / 2)
+            ++levels;
+        return levels;
+    }
+
+    // Relative cost of visiting a node compared to intersecting an object.
+    double const traversalCost = 0.125;
+
+    // Round outwards so that the float box always contains the double box.
+    float roundDown(double value)
+    {
+        return nextafter(static_cast<float>(value), -numeric_limits<float>::infinity());
+    }
+
+    float roundUp(double value)
+    {
+        return nextafter(static_cast<float>(value), numeric_limits<float>::infinity());
+    }
+
+    // Slab test against a node, see BoundingBox::intersect.
+    inline bool hitsNode(float const *lower, float const *upper,
+                         Ray const &ray, Vector const &inverse, double tMax)
+    {
+        double tNear = 0.0;
+        double tFar = tMax;
+        for (unsigned axis = 0; axis != 3; ++axis)
+        {
+            double t0 = (lower[axis] - ray.O.data[axis]) * inverse.data[axis];
+            double t1 = (upper[axis] - ray.O.data[axis]) * inverse.data[axis];
+            if (t0 > t1)
+                swap(t0, t1);
+
+            tNear = t0 > tNear ? t0 : tNear;
+            tFar = t1 < tFar ? t1 : tFar;
+        }
+        return tNear <= tFar;
+    }
+
+    // hitsNode for every lane of the packet, with the same arithmetic so
+    // that a lane hits the same nodes as its ray alone.
+    inline RayPacket::Mask hitsNode(float const *lower, float const *upper,
+                                    RayPacket const &packet, double const *tMax)
+    {
+        RayPacket::Mask mask = 0;
+        for (unsigned lane = 0; lane != packet.size; ++lane)
+        {
+            double tNear = 0.0;
+            double tFar = tMax[lane];
+            for (unsigned axis = 0; axis != 3; ++axis)
+            {
+                double t0 = (lower[axis] - packet.origin[axis][lane]) * packet.inverse[axis][lane];
+                double t1 = (upper[axis] - packet.origin[axis][lane]) * packet.inverse[axis][lane];
+                double tEntry = t0 > t1 ? t1 : t0;
+                double tExit = t0 > t1 ? t0 : t1;
+
+                tNear = tEntry > tNear ? tEntry : tNear;
+                tFar = tExit < tFar ? tExit : tFar;
+            }
+            mask |= RayPacket::Mask(tNear <= tFar) << lane;
+        }
+        return mask;
+    }
+
+#ifdef SIMD_X86
+
+    // hitsNode over 4 lanes at a time. The selects of the scalar test are
+    // those of std::min and std::max, so the lanes match it bit for bit.
+    __attribute__((target("avx2")))
+    RayPacket::Mask hitsNodeAvx2(float const *lower, float const *upper,
+                                 RayPacket const &packet, double const *tMax)
+    {
+        RayPacket::Mask mask = 0;
+        for (unsigned first = 0; first < packet.size; first += 4)
+        {
+            // The last batch may be partial.
+            __m256i loadMask = _mm256_cmpgt_epi64(_mm256_set1_epi64x(packet.size - first),
+                                                  _mm256_set_epi64x(3, 2, 1, 0));
+            __m256d tNear = _mm256_setzero_pd();
+            __m256d tFar = _mm256_maskload_pd(tMax + first, loadMask);
+            for (unsigned axis = 0; axis != 3; ++axis)
+            {
+                __m256d origin = _mm256_maskload_pd(packet.origin[axis] + first, loadMask);
+                __m256d inverse = _mm256_maskload_pd(packet.inverse[axis] + first, loadMask);
+                __m256d t0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(lower[axis]), origin), inverse);
+                __m256d t1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(upper[axis]), origin), inverse);
+
+                tNear = maxAvx2(tNear, minAvx2(t0, t1));
+                tFar = minAvx2(tFar, maxAvx2(t1, t0));
+            }
+            __m256d hits = _mm256_and_pd(_mm256_cmp_pd(tNear, tFar, _CMP_LE_OQ),
+                                         _mm256_castsi256_pd(loadMask));
+            mask |= RayPacket::Mask(_mm256_movemask_pd(hits)) << first;
+        }
+        return mask;
+    }
+
+    // hitsNode over 2 lanes at a time, as hitsNodeAvx2. _mm_min_pd(b, a)
+    // and _mm_max_pd(b, a) select as std::min(a, b) and std::max(a, b).
+    __attribute__((target("sse4.1")))
+    RayPacket::Mask hitsNodeSse4(float const *lower, float const *upper,
+                                 RayPacket const &packet, double const *tMax)
+    {
+        RayPacket::Mask mask = 0;
+        for (unsigned first = 0; first < packet.size; first += 2)
+        {
+            // The last batch may be a single lane, the other one is zero.
+            bool pair = first + 1 < packet.size;
+            __m128d tNear = _mm_setzero_pd();
+            __m128d tFar = load2(tMax + first, pair);
+            for (unsigned axis = 0; axis != 3; ++axis)
+            {
+                __m128d origin = load2(packet.origin[axis] + first, pair);
+                __m128d inverse = load2(packet.inverse[axis] + first, pair);
+                __m128d t0 = _mm_mul_pd(_mm_sub_pd(_mm_set1_pd(lower[axis]), origin), inverse);
+                __m128d t1 = _mm_mul_pd(_mm_sub_pd(_mm_set1_pd(upper[axis]), origin), inverse);
+
+                tNear = _mm_max_pd(_mm_min_pd(t1, t0), tNear);
+                tFar = _mm_min_pd(_mm_max_pd(t0, t1), tFar);
+            }
+            int hits = _mm_movemask_pd(_mm_cmple_pd(tNear, tFar)) & (pair ? 3 : 1);
+            mask |= RayPacket::Mask(hits) << first;
+        }
+        return mask;
+    }
+
+#endif
+
+    // The packet test of the given kernel, see PrimitiveArrays::kernel.
+    inline RayPacket::Mask hitsNode(PrimitiveArrays::Kernel kernel, float const *lower,
+                                    float const *upper, RayPacket const &packet, double const *tMax)
+    {
+        switch (kernel)
+        {
+#ifdef SIMD_X86
+            case PrimitiveArrays::Kernel::Avx2:
+                return hitsNodeAvx2(lower, upper, packet, tMax);
+            case PrimitiveArrays::Kernel::Sse4:
+                return hitsNodeSse4(lower, upper, packet, tMax);
+#endif
+            default:
+                return hitsNode(lower, upper, packet, tMax);
+        }
+    }
+}
+
+void BVH::build(vector<ObjectPtr> const &objects)
+{
+    d_nodes.clear();
+    d_objects.clear();
+    if (objects.empty())
+        return;
+
+    vector<BuildEntry> entries;
+    entries.reserve(objects.size());
+    for (ObjectPtr const &object : objects)
+    {
+        BoundingBox bounds = object->bounds();
+        entries.push_back(BuildEntry{bounds, bounds.center(), object});
+    }
+
+    d_nodes.reserve(2 * objects.size());
+    d_objects.reserve(objects.size());
+    buildRecursive(entries, 0, entries.size(), 0);
+
+    d_primitives.clear();
+    d_spheresBefore.assign(1, 0);
+    d_quadsBefore.assign(1, 0);
+    for (ObjectPtr const &object : d_objects)
+    {
+        if (PrimitiveArrays::accepts(*object))
+            d_primitives.add(object);
+        d_spheresBefore.push_back(d_primitives.sphereCount());
+        d_quadsBefore.push_back(d_primitives.quadCount());
+    }
+}
+
+unsigned BVH::buildRecursive(vector<BuildEntry> &entries, size_t begin, size_t end, unsigned depth)
+{
+    assert(depth < maxDepth);
+
+    BoundingBox bounds;
+    BoundingBox centroidBounds;
+    for (size_t idx = begin; idx != end; ++idx)
+    {
+        bounds.extend(entries[idx].bounds);
+        centroidBounds.extend(entries[idx].centroid);
+    }
+
+    unsigned index = d_nodes.size();
+    d_nodes.push_back(Node());
+    for (unsigned axis = 0; axis != 3; ++axis)
+    {
+        d_nodes[index].lower[axis] = roundDown(bounds.lower.data[axis]);
+        d_nodes[index].upper[axis] = roundUp(bounds.upper.data[axis]);
+    }
+
+    auto makeLeaf = [&]()
+    {
+        auto quads = stable_partition(entries.begin() + begin, entries.begin() + end,
+                                      [](BuildEntry const &entry)
+                                      {
+                                          return PrimitiveArrays::isSphere(*entry.object);
+                                      });
+        stable_partition(quads, entries.begin() + end, [](BuildEntry const &entry)
+                                      {
+                                          return PrimitiveArrays::isQuad(*entry.object);
+                                      });
+
+        d_nodes[index].offset = d_objects.size();
+        d_nodes[index].count = end - begin;
+        d_nodes[index].axis = 0;
+        for (size_t idx = begin; idx != end; ++idx)
+            d_objects.push_back(entries[idx].object);
+        return index;
+    };
+
+    size_t count = end - begin;
+    if (count == 1)
+        return makeLeaf();
+
+    unsigned axis = centroidBounds.largestAxis();
+    double axisLower = centroidBounds.lower.data[axis];
+    double axisExtent = centroidBounds.upper.data[axis] - axisLower;
+
+    size_t middle = begin + count / 2;
+    bool splitAtMedian = true;
+    if (axisExtent <= 0.0)
+    {
+        // All centroids coincide, the heuristic cannot separate them.
+        if (count <= maxLeafSize)
+            return makeLeaf();
+    }
+    else if (depth < maxSahDepth and depth + 1 + medianDepth(count) < maxDepth)
+    {
+        auto binOf = [&](BuildEntry const &entry)
+        {
+            size_t bin = binCount * ((entry.centroid.data[axis] - axisLower) / axisExtent);
+            return min(bin, binCount - 1);
+        };
+
+        // Bin the objects by centroid.
+        BoundingBox binBounds[binCount];
+        size_t binSizes[binCount] = {};
+        for (size_t idx = begin; idx != end; ++idx)
+        {
+            size_t bin = binOf(entries[idx]);
+            binBounds[bin].extend(entries[idx].bounds);
+            ++binSizes[bin];
+        }
+
+        // Evaluate the surface area heuristic for splits after every bin.
+        size_t bestSplit = 0;
+        double bestCost = numeric_limits<double>::infinity();
+        for (size_t split = 0; split != binCount - 1; ++split)
+        {
+            BoundingBox left;
+            BoundingBox right;
+            size_t leftSize = 0;
+            size_t rightSize = 0;
+            for (size_t bin = 0; bin <= split; ++bin)
+            {
+                left.extend(binBounds[bin]);
+                leftSize += binSizes[bin];
+            }
+            for (size_t bin = split + 1; bin != binCount; ++bin)
+            {
+                right.extend(binBounds[bin]);
+                rightSize += binSizes[bin];
+            }
+
+            double cost = traversalCost + (leftSize * left.surfaceArea() +
+                                           rightSize * right.surfaceArea()) / bounds.surfaceArea();
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestSplit = split;
+            }
+        }
+
+        // Splitting is only worth it if it is cheaper than testing every object.
+        if (count <= maxLeafSize and bestCost >= count)
+            return makeLeaf();
+
+        size_t split = partition(entries.begin() + begin, entries.begin() + end,
+                                 [&](BuildEntry const &entry)
+                                 {
+                                     return binOf(entry) <= bestSplit;
+                                 }) - entries.begin();
+
+        if (split != begin and split != end)
+        {
+            middle = split;
+            splitAtMedian = false;
+        }
+    }
+
+    if (splitAtMedian)
+    {
+        nth_element(entries.begin() + begin, entries.begin() + middle, entries.begin() + end,
+                    [&](BuildEntry const &lhs, BuildEntry const &rhs)
+                    {
+                        return lhs.centroid.data[axis] < rhs.centroid.data[axis];
+                    });
+    }
+
+    d_nodes[index].count = 0;
+    d_nodes[index].axis = axis;
+    buildRecursive(entries, begin, middle, depth + 1);
+    unsigned second = buildRecursive(entries, middle, end, depth + 1);
+    d_nodes[index].offset = second;
+    return index;
+}
+
+ObjectPtr BVH::intersect(Ray const &ray, Hit &minHit) const
+{
+    ObjectPtr obj = nullptr;
+    if (d_nodes.empty())
+        return obj;
+
+    Vector inverse(1.0 / ray.D.x, 1.0 / ray.D.y, 1.0 / ray.D.z);
+
+    unsigned stack[maxDepth];
+    unsigned stackSize = 0;
+    unsigned current = 0;
+    while (true)
+    {
+        Node const &node = d_nodes[current];
+        if (hitsNode(node.lower, node.upper, ray, inverse, minHit.t))
+        {
+            if (node.count > 0)
+            {
+                unsigned end = node.offset + node.count;
+                uint32_t spheresBegin = d_spheresBefore[node.offset];
+                uint32_t spheresEnd = d_spheresBefore[end];
+                uint32_t quadsBegin = d_quadsBefore[node.offset];
+                uint32_t quadsEnd = d_quadsBefore[end];
+
+                double t = minHit.t;
+                size_t sphere = d_primitives.closestSphere(ray, spheresBegin, spheresEnd, t);
+                size_t quad = d_primitives.closestQuad(ray, quadsBegin, quadsEnd, t);
+                if (quad != PrimitiveArrays::npos)
+                {
+                    minHit = d_primitives.quadHit(quad, t);
+                    obj = d_primitives.quad(quad);
+                }
+                else if (sphere != PrimitiveArrays::npos)
+                {
+                    minHit = d_primitives.sphereHit(sphere, ray, t);
+                    obj = d_primitives.sphere(sphere);
+                }
+
+                unsigned others = node.offset + (spheresEnd - spheresBegin) + (quadsEnd - quadsBegin);
+                for (unsigned idx = others; idx != end; ++idx)
+                {
+                    if (Statistics::enabled)
+                        Statistics::local().countIntersectionTest(*d_objects[idx]);
+
+                    Hit hit(d_objects[idx]->intersect(ray));
+                    if (hit.t < minHit.t)
+                    {
+                        minHit = hit;
+                        obj = d_objects[idx];
+                    }
+                }
+            }
+            else
+            {
+                // Visit the child nearest to the ray origin first, so that
+                // the far child can often be culled by the closest hit.
+                if (ray.D.data[node.axis] < 0.0)
+                {
+                    stack[stackSize++] = current + 1;
+                    current = node.offset;
+                }
+                else
+                {
+                    stack[stackSize++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+
+        if (stackSize == 0)
+            break;
+        current = stack[--stackSize];
+    }
+
+    return obj;
+}
+
+void BVH::intersect(RayPacket const &packet, Hit *minHits, ObjectPtr *objects) const
+{
+    if (d_nodes.empty())
+        return;
+
+    double tMax[RayPacket::maxSize];
+    for (unsigned lane = 0; lane != packet.size; ++lane)
+        tMax[lane] = minHits[lane].t;
+
+    PrimitiveArrays::Kernel kernel = PrimitiveArrays::kernel();
+    unsigned stack[maxDepth];
+    unsigned stackSize = 0;
+    unsigned current = 0;
+    while (true)
+    {
+        Node const &node = d_nodes[current];
+        RayPacket::Mask mask = hitsNode(kernel, node.lower, node.upper, packet, tMax);
+        if (mask != 0)
+        {
+            if (node.count > 0)
+            {
+                unsigned end = node.offset + node.count;
+                uint32_t spheresBegin = d_spheresBefore[node.offset];
+                uint32_t spheresEnd = d_spheresBefore[end];
+                uint32_t quadsBegin = d_quadsBefore[node.offset];
+                uint32_t quadsEnd = d_quadsBefore[end];
+
+                // The kernels test one ray against several primitives.
+                for (unsigned lane = 0; lane != packet.size; ++lane)
+                {
+                    if (not (mask >> lane & 1))
+                        continue;
+
+                    Ray const &ray = *packet.rays[lane];
+                    double t = minHits[lane].t;
+                    size_t sphere = d_primitives.closestSphere(ray, spheresBegin, spheresEnd, t);
+                    size_t quad = d_primitives.closestQuad(ray, quadsBegin, quadsEnd, t);
+                    if (quad != PrimitiveArrays::npos)
+                    {
+                        minHits[lane] = d_primitives.quadHit(quad, t);
+                        objects[lane] = d_primitives.quad(quad);
+                    }
+                    else if (sphere != PrimitiveArrays::npos)
+                    {
+                        minHits[lane] = d_primitives.sphereHit(sphere, ray, t);
+                        objects[lane] = d_primitives.sphere(sphere);
+                    }
+                }
+
+                unsigned others = node.offset + (spheresEnd - spheresBegin) + (quadsEnd - quadsBegin);
+                for (unsigned idx = others; idx != end; ++idx)
+                {
+                    if (Statistics::enabled)
+                    {
+                        for (unsigned lane = 0; lane != packet.size; ++lane)
+                            if (mask >> lane & 1)
+                                Statistics::local().countIntersectionTest(*d_objects[idx]);
+                    }
+
+                    RayPacket::Mask closer = d_objects[idx]->intersectPacket(packet, mask, minHits);
+                    for (unsigned lane = 0; lane != packet.size; ++lane)
+                        if (closer >> lane & 1)
+                            objects[lane] = d_objects[idx];
+                }
+
+                for (unsigned lane = 0; lane != packet.size; ++lane)
+                    tMax[lane] = minHits[lane].t;
+            }
+            else
+            {
+                // The near child of the first lane that hits the node, the
+                // rays of a packet mostly agree.
+                unsigned first = 0;
+                while (not (mask >> first & 1))
+                    ++first;
+
+                if (packet.rays[first]->D.data[node.axis] < 0.0)
+                {
+                    stack[stackSize++] = current + 1;
+                    current = node.offset;
+                }
+                else
+                {
+                    stack[stackSize++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+
+        if (stackSize == 0)
+            break;
+        current = stack[--stackSize];
+    }
+}
+
+bool BVH::occluded(Ray const &ray, double maxT) const
+{
+    if (d_nodes.empty())
+        return false;
+
+    Vector inverse(1.0 / ray.D.x, 1.0 / ray.D.y, 1.0 / ray.D.z);
+
+    // Any hit will do, so the children are visited in storage order.
+    unsigned stack[maxDepth];
+    unsigned stackSize = 0;
+    unsigned current = 0;
+    while (true)
+    {
+        Node const &node = d_nodes[current];
+        if (hitsNode(node.lower, node.upper, ray, inverse, maxT))
+        {
+            if (node.count > 0)
+            {
+                unsigned end = node.offset + node.count;
+                uint32_t spheresBegin = d_spheresBefore[node.offset];
+                uint32_t spheresEnd = d_spheresBefore[end];
+                uint32_t quadsBegin = d_quadsBefore[node.offset];
+                uint32_t quadsEnd = d_quadsBefore[end];
+
+                double t = maxT;
+                if (d_primitives.closestSphere(ray, spheresBegin, spheresEnd, t) != PrimitiveArrays::npos
+                    or d_primitives.closestQuad(ray, quadsBegin, quadsEnd, t) != PrimitiveArrays::npos)
+                    return true;
+
+                unsigned others = node.offset + (spheresEnd - spheresBegin) + (quadsEnd - quadsBegin);
+                for (unsigned idx = others; idx != end; ++idx)
+                {
+                    if (Statistics::enabled)
+                        Statistics::local().countIntersectionTest(*d_objects[idx]);
+
+                    if (d_objects[idx]->occludes(ray, maxT))
+                        return true;
+                }
+            }
+            else
+            {
+                stack[stackSize++] = node.offset;
+                current = current + 1;
+                continue;
+            }
+        }
+
+        if (stackSize == 0)
+            break;
+        current = stack[--stackSize];
+    }
+
+    return false;
+}
+
+size_t BVH::size() const
+{
+    return d_objects.size();
+}
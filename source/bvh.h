@@ -0,0 +1,71 @@
+#ifndef BVH_H_
+#define BVH_H_
+
+#include "bounding_box.h"
+#include "hit.h"
+#include "object.h"
+#include "primitive_arrays.h"
+#include "ray.h"
+#include "ray_packet.h"
+
+#include <cstdint>
+#include <vector>
+
+// Bounding volume hierarchy over objects with finite bounds. The tree is
+// built with the surface area heuristic and flattened into a depth first
+// node array: the first child of an interior node directly follows it.
+// Leaves list their spheres first and their quads next, which are tested
+// as ranges of packed arrays in leaf order, see PrimitiveArrays.
+class BVH
+{
+    // 32 bytes, two nodes per cache line.
+    struct Node
+    {
+        float lower[3];
+        float upper[3];
+        uint32_t offset;    // leaf: index of the first object, interior: second child
+        uint16_t count;     // number of objects in a leaf, 0 for interior nodes
+        uint8_t axis;       // split axis of interior nodes
+        uint8_t padding;
+    };
+
+    struct BuildEntry
+    {
+        BoundingBox bounds;
+        Point centroid;
+        ObjectPtr object;
+    };
+
+    std::vector<Node> d_nodes;
+    std::vector<ObjectPtr> d_objects;   // objects in leaf order
+
+    // The spheres and quads of d_objects, and the number of them before
+    // every object.
+    PrimitiveArrays d_primitives;
+    std::vector<uint32_t> d_spheresBefore;
+    std::vector<uint32_t> d_quadsBefore;
+
+    public:
+        // Objects must have finite bounds, see Object::bounds.
+        void build(std::vector<ObjectPtr> const &objects);
+
+        // Closest object hit before minHit.t, which is updated on a hit.
+        // Returns nullptr if no such object exists.
+        ObjectPtr intersect(Ray const &ray, Hit &minHit) const;
+
+        // intersect for every ray of the packet, which share the visits of
+        // the nodes. minHits and objects hold the result of every lane, a
+        // lane keeps its object if no closer one is found.
+        void intersect(RayPacket const &packet, Hit *minHits, ObjectPtr *objects) const;
+
+        // Whether any object is hit before maxT. Stops at the first hit found.
+        bool occluded(Ray const &ray, double maxT) const;
+
+        size_t size() const;
+
+    private:
+        unsigned buildRecursive(std::vector<BuildEntry> &entries, size_t begin, size_t end,
+                                unsigned depth);
+};
+
+#endif
@@ -0,0 +1,231 @@
+#include "checkpoint.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+namespace
+{
+    char const magic[8] = {'R', 'T', 'C', 'H', 'E', 'C', 'K', 'P'};
+    uint32_t const version = 2;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        uint32_t tileSize;
+        uint32_t tileCount;
+        uint32_t seed;
+        uint64_t sceneHash;
+    };
+    static_assert(sizeof(Header) == 40, "the checkpoint header must not contain padding");
+
+    // Size of the tile flags, padded so that the pixels are aligned.
+    size_t flagsSize(size_t tileCount)
+    {
+        return (tileCount + 7) / 8 * 8;
+    }
+
+    // Offset of the pixels of the tile with the given index.
+    size_t slotOffset(size_t tileCount, unsigned tileSize, unsigned index)
+    {
+        size_t slotSize = 3 * sizeof(float) * tileSize * tileSize;
+        return sizeof(Header) + flagsSize(tileCount) + index * slotSize;
+    }
+}
+
+Checkpoint::Checkpoint(string const &filename, double interval, uint64_t sceneHash)
+:
+    d_filename(filename),
+    d_interval(chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(interval))),
+    d_sceneHash(sceneHash)
+{}
+
+unsigned Checkpoint::start(Framebuffer &img, vector<Tile> const &tiles, unsigned tileSize,
+                           unsigned seed, bool fixedSeed)
+{
+    lock_guard<mutex> lock(d_mutex);
+
+    d_width = img.width();
+    d_height = img.height();
+    d_tileSize = max(tileSize, 1u);     // as in TileScheduler
+    d_tileCount = tiles.size();
+    d_seed = seed;
+    d_nextSave = chrono::steady_clock::now() + d_interval;
+    d_unsaved.clear();
+
+    if (not load(img, tiles, fixedSeed))
+    {
+        d_finished.assign(tiles.size(), 0);
+        create();
+    }
+
+    return d_seed;
+}
+
+bool Checkpoint::isFinished(Tile const &tile) const
+{
+    lock_guard<mutex> lock(d_mutex);
+    return d_finished[tile.index];
+}
+
+void Checkpoint::finish(Tile const &tile, Framebuffer const &img)
+{
+    vector<Tile> tiles;
+    {
+        lock_guard<mutex> lock(d_mutex);
+        d_finished[tile.index] = 1;
+        d_unsaved.push_back(tile);
+
+        // One thread saves at a time, the others go on rendering.
+        if (d_saving or chrono::steady_clock::now() < d_nextSave)
+            return;
+        d_saving = true;
+        tiles.swap(d_unsaved);
+    }
+
+    // Finished tiles are no longer written to, so they are read without
+    // the lock.
+    bool saved = save(img, tiles);
+
+    lock_guard<mutex> lock(d_mutex);
+    if (not saved)      // retried with the next save
+        d_unsaved.insert(d_unsaved.end(), tiles.begin(), tiles.end());
+    d_saving = false;
+    d_nextSave = chrono::steady_clock::now() + d_interval;
+}
+
+unsigned Checkpoint::finishedTiles() const
+{
+    lock_guard<mutex> lock(d_mutex);
+    return count(d_finished.begin(), d_finished.end(), 1);
+}
+
+void Checkpoint::remove() const
+{
+    std::remove(d_filename.c_str());
+}
+
+bool Checkpoint::load(Framebuffer &img, vector<Tile> const &tiles, bool fixedSeed)
+{
+    ifstream file(d_filename, ios::binary);
+    if (not file)
+        return false;
+
+    Header header;
+    if (not file.read(reinterpret_cast<char *>(&header), sizeof(header)))
+        return false;
+
+    // A checkpoint of another render is ignored, and overwritten.
+    if (memcmp(header.magic, magic, sizeof(magic)) != 0 or header.version != version
+        or header.width != d_width or header.height != d_height
+        or header.tileSize != d_tileSize or header.tileCount != tiles.size()
+        or header.sceneHash != d_sceneHash or (fixedSeed and header.seed != d_seed))
+    {
+        cerr << "Warning: " << d_filename << " is not a checkpoint of this render, starting over.\n";
+        return false;
+    }
+
+    vector<uint8_t> finished(flagsSize(tiles.size()));
+    if (not file.read(reinterpret_cast<char *>(finished.data()), finished.size()))
+        return false;
+    finished.resize(tiles.size());
+
+    vector<float> slot(3 * d_tileSize * d_tileSize);
+    for (Tile const &tile : tiles)
+    {
+        if (not finished[tile.index])
+            continue;
+
+        file.seekg(slotOffset(tiles.size(), d_tileSize, tile.index));
+        if (not file.read(reinterpret_cast<char *>(slot.data()), slot.size() * sizeof(float)))
+            return false;
+
+        for (unsigned y = tile.y0; y != tile.y1; ++y)
+        {
+            for (unsigned x = tile.x0; x != tile.x1; ++x)
+            {
+                float const *pixel = &slot[3 * ((y - tile.y0) * d_tileSize + x - tile.x0)];
+                img.put_pixel(x, y, Color(pixel[0], pixel[1], pixel[2]));
+            }
+        }
+    }
+
+    d_finished = finished;
+    d_seed = header.seed;
+    cout << "Resuming from " << d_filename << ", " << count(finished.begin(), finished.end(), 1)
+         << " of " << tiles.size() << " tiles are finished.\n";
+    return true;
+}
+
+// Writes the header and the flags of a render without finished tiles.
+bool Checkpoint::create() const
+{
+    ofstream file(d_filename, ios::binary | ios::trunc);
+
+    Header header;
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.width = d_width;
+    header.height = d_height;
+    header.tileSize = d_tileSize;
+    header.tileCount = d_tileCount;
+    header.seed = d_seed;
+    header.sceneHash = d_sceneHash;
+    file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+
+    vector<uint8_t> finished(flagsSize(d_tileCount), 0);
+    file.write(reinterpret_cast<char const *>(finished.data()), finished.size());
+
+    file.close();
+    if (not file)
+        cerr << "Error: could not write checkpoint " << d_filename << ".\n";
+    return bool(file);
+}
+
+// Writes the pixels of the tiles to their slots, and only then flags them,
+// so that an interruption while saving leaves a valid checkpoint. Called
+// without the lock: it only reads members that are fixed by start.
+bool Checkpoint::save(Framebuffer const &img, vector<Tile> const &tiles) const
+{
+    fstream file(d_filename, ios::in | ios::out | ios::binary);
+
+    vector<float> slot(3 * d_tileSize * d_tileSize);
+    for (Tile const &tile : tiles)
+    {
+        fill(slot.begin(), slot.end(), 0.0f);
+        for (unsigned y = tile.y0; y != tile.y1; ++y)
+        {
+            for (unsigned x = tile.x0; x != tile.x1; ++x)
+            {
+                Color color = img.get_pixel(x, y);
+                float *pixel = &slot[3 * ((y - tile.y0) * d_tileSize + x - tile.x0)];
+                pixel[0] = color.r;
+                pixel[1] = color.g;
+                pixel[2] = color.b;
+            }
+        }
+
+        file.seekp(slotOffset(d_tileCount, d_tileSize, tile.index));
+        file.write(reinterpret_cast<char const *>(slot.data()), slot.size() * sizeof(float));
+    }
+    file.flush();
+
+    uint8_t const flag = 1;
+    for (Tile const &tile : tiles)
+    {
+        file.seekp(sizeof(Header) + tile.index);
+        file.write(reinterpret_cast<char const *>(&flag), 1);
+    }
+
+    file.close();
+    if (not file)
+        cerr << "Error: could not write checkpoint " << d_filename << ".\n";
+    return bool(file);
+}
@@ -0,0 +1,70 @@
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include "framebuffer.h"
+#include "tile_scheduler.h"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Periodically saves the finished tiles of a render to a file, from which an
+// interrupted render is resumed. Since every tile seeds its own random
+// stream from the seed of the render, the seed is all the random state that
+// needs to be saved for a resumed render to match an uninterrupted one.
+//
+// The file consists of a 40 byte header (see Header in checkpoint.cpp), one
+// byte per tile that is 1 if the tile is finished, padded to a multiple of 8
+// bytes, and one slot per tile, in tile order, of tileSize x tileSize pixels
+// as 3 floats each, row by row. Only the slots of finished tiles are
+// written, and a tile is flagged once its slot is, so saving adds the tiles
+// finished since the last save without rewriting the rest. All data is
+// aligned and at a fixed offset, so the file can also be memory mapped.
+class Checkpoint
+{
+    std::string d_filename;
+    std::chrono::steady_clock::duration d_interval;
+    std::chrono::steady_clock::time_point d_nextSave;
+    uint64_t d_sceneHash;
+    unsigned d_width = 0;
+    unsigned d_height = 0;
+    unsigned d_tileSize = 0;
+    unsigned d_tileCount = 0;
+    unsigned d_seed = 0;
+    std::vector<uint8_t> d_finished;
+    std::vector<Tile> d_unsaved;        // finished, not yet in the file
+    bool d_saving = false;
+    mutable std::mutex d_mutex;
+
+    public:
+        // The scene hash identifies the scene the checkpoint belongs to.
+        Checkpoint(std::string const &filename, double interval, uint64_t sceneHash);
+
+        // Restores the finished tiles into img if the file belongs to the
+        // same scene, image size and tiling (and seed, if fixed). Returns the
+        // seed of the render, which is the given one for a new render.
+        unsigned start(Framebuffer &img, std::vector<Tile> const &tiles, unsigned tileSize,
+                       unsigned seed, bool fixedSeed);
+
+        bool isFinished(Tile const &tile) const;
+
+        // Marks the tile as finished and saves the checkpoint if the
+        // interval has passed. Safe to call from the worker threads: the
+        // saving thread writes without holding the lock, and the others do
+        // not wait for it.
+        void finish(Tile const &tile, Framebuffer const &img);
+
+        unsigned finishedTiles() const;
+
+        // Deletes the file, once the render is complete.
+        void remove() const;
+
+    private:
+        bool load(Framebuffer &img, std::vector<Tile> const &tiles, bool fixedSeed);
+        bool create() const;
+        bool save(Framebuffer const &img, std::vector<Tile> const &tiles) const;
+};
+
+#endif
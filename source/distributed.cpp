@@ -0,0 +1,439 @@
+#include "distributed.h"
+
+#include "raytracer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+    // Sent by a worker in place of a tile index.
+    uint32_t const heartbeat = 0xffffffff;
+
+    // Reads exactly size bytes, false on end of file or error.
+    bool readAll(int socket, void *data, size_t size)
+    {
+        char *position = static_cast<char *>(data);
+        while (size > 0)
+        {
+            ssize_t count = read(socket, position, size);
+            if (count < 0 and errno == EINTR)
+                continue;
+            if (count <= 0)
+                return false;
+            position += count;
+            size -= count;
+        }
+        return true;
+    }
+
+    // Writes exactly size bytes. A closed peer is an error rather than a
+    // SIGPIPE, so that a failing worker does not take the coordinator down.
+    bool writeAll(int socket, void const *data, size_t size)
+    {
+        char const *position = static_cast<char const *>(data);
+        while (size > 0)
+        {
+            ssize_t count = send(socket, position, size, MSG_NOSIGNAL);
+            if (count < 0 and errno == EINTR)
+                continue;
+            if (count <= 0)
+                return false;
+            position += count;
+            size -= count;
+        }
+        return true;
+    }
+
+    // Sends a heartbeat every interval in which the other threads of the
+    // worker used processor time, until it is destroyed. A worker that is
+    // stopped or blocked sends none, one that renders a slow tile keeps
+    // sending them.
+    class Heartbeat
+    {
+        int d_socket;
+        mutex &d_socketMutex;
+        chrono::milliseconds d_interval;
+        mutex d_mutex;
+        condition_variable d_condition;
+        bool d_stopped = false;
+        thread d_thread;
+
+        public:
+            Heartbeat(int socket, mutex &socketMutex, chrono::milliseconds interval)
+            :
+                d_socket(socket),
+                d_socketMutex(socketMutex),
+                d_interval(interval)
+            {
+                if (d_interval.count() > 0)
+                    d_thread = thread(&Heartbeat::run, this);
+            }
+
+            ~Heartbeat()
+            {
+                {
+                    lock_guard<mutex> lock(d_mutex);
+                    d_stopped = true;
+                }
+                d_condition.notify_one();
+                if (d_thread.joinable())
+                    d_thread.join();
+            }
+
+        private:
+            // Processor time of the process, without that of this thread.
+            static chrono::nanoseconds renderTime()
+            {
+                timespec process;
+                timespec self;
+                clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &process);
+                clock_gettime(CLOCK_THREAD_CPUTIME_ID, &self);
+                return chrono::seconds(process.tv_sec - self.tv_sec)
+                       + chrono::nanoseconds(process.tv_nsec - self.tv_nsec);
+            }
+
+            void run()
+            {
+                chrono::nanoseconds used = renderTime();
+                unique_lock<mutex> lock(d_mutex);
+                while (not d_condition.wait_for(lock, d_interval, [&] { return d_stopped; }))
+                {
+                    chrono::nanoseconds now = renderTime();
+                    if (now == used)
+                        continue;
+                    used = now;
+
+                    lock_guard<mutex> socketLock(d_socketMutex);
+                    writeAll(d_socket, &heartbeat, sizeof(heartbeat));
+                }
+            }
+    };
+
+    // The worker side of the protocol, see Coordinator.
+    void work(int socket, string const &sceneFile)
+    {
+        Raytracer raytracer;
+        if (not raytracer.readScene(sceneFile))
+            return;
+
+        Job job;
+        if (not readAll(socket, &job, sizeof(job)))
+            return;
+
+        raytracer.setSize(job.width, job.height);
+        raytracer.setThreadCount(job.threadCount);
+        raytracer.setPacketSize(job.packetSize);
+        if (job.heatmap != 0)
+            raytracer.setHeatmap(static_cast<Heatmap::Metric>(job.heatmap - 1));
+
+        mutex socketMutex;
+        Heartbeat beat(socket, socketMutex, chrono::milliseconds(job.heartbeat));
+        bool connected = true;
+        while (connected)
+        {
+            uint32_t count;
+            if (not readAll(socket, &count, sizeof(count)))
+                return;
+            vector<uint32_t> indices(count);
+            if (not readAll(socket, indices.data(), count * sizeof(uint32_t)))
+                return;
+
+            // Every tile is rendered into a buffer of its own, a worker does
+            // not hold the whole image.
+            raytracer.renderTiles(vector<unsigned>(indices.begin(), indices.end()), job.seed,
+                                  [&](Tile const &tile, Framebuffer const &img, Heatmap const *heatmap)
+            {
+                // Encoded outside of the lock, the other threads keep sending.
+                uint32_t index = tile.index;
+                vector<float> pixels;
+                vector<uint64_t> costs;
+                for (unsigned y = 0; y != img.height(); ++y)
+                {
+                    for (unsigned x = 0; x != img.width(); ++x)
+                    {
+                        Color color = img.get_pixel(x, y);
+                        pixels.insert(pixels.end(), {static_cast<float>(color.r),
+                                                     static_cast<float>(color.g),
+                                                     static_cast<float>(color.b)});
+                        if (heatmap)
+                            costs.push_back((*heatmap)(x, y));
+                    }
+                }
+
+                lock_guard<mutex> lock(socketMutex);
+                connected = connected
+                    and writeAll(socket, &index, sizeof(index))
+                    and writeAll(socket, pixels.data(), pixels.size() * sizeof(float))
+                    and writeAll(socket, costs.data(), costs.size() * sizeof(uint64_t));
+            });
+        }
+    }
+}
+
+Coordinator::Coordinator(string const &sceneFile, unsigned workerCount,
+                         chrono::milliseconds timeout)
+:
+    d_timeout(timeout)
+{
+    // Output still in the buffers would be written again by every worker.
+    cout.flush();
+
+    for (unsigned idx = 0; idx != workerCount; ++idx)
+    {
+        int sockets[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+        {
+            cerr << "Error: could not create a socket for worker " << idx << ".\n";
+            break;
+        }
+
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            cerr << "Error: could not start worker " << idx << ".\n";
+            close(sockets[0]);
+            close(sockets[1]);
+            break;
+        }
+
+        if (pid == 0)
+        {
+            // Only the coordinator may hold the other end of the sockets,
+            // or it would not notice workers failing.
+            close(sockets[0]);
+            for (Worker const &worker : d_workers)
+                close(worker.socket);
+
+            // The progress output of the workers would repeat that of the
+            // coordinator, errors are still reported.
+            cout.setstate(ios::failbit);
+
+            work(sockets[1], sceneFile);
+            _exit(0);
+        }
+
+        close(sockets[1]);
+
+        // A worker that stops halfway through a tile fails the read, rather
+        // than blocking the coordinator.
+        if (d_timeout.count() > 0)
+        {
+            timeval receiveTimeout{static_cast<time_t>(d_timeout.count() / 1000),
+                                   static_cast<suseconds_t>(d_timeout.count() % 1000 * 1000)};
+            setsockopt(sockets[0], SOL_SOCKET, SO_RCVTIMEO, &receiveTimeout, sizeof(receiveTimeout));
+        }
+
+        d_workers.push_back(Worker{pid, sockets[0], {}, {}});
+    }
+}
+
+Coordinator::~Coordinator()
+{
+    // Closing the sockets ends the workers.
+    for (Worker &worker : d_workers)
+    {
+        if (worker.socket >= 0)
+            close(worker.socket);
+    }
+
+    for (Worker &worker : d_workers)
+    {
+        if (worker.pid > 0)
+            waitpid(worker.pid, nullptr, 0);
+    }
+}
+
+vector<unsigned> Coordinator::render(Job job, vector<Tile> const &tiles,
+                                     Framebuffer &img, Heatmap *heatmap)
+{
+    // Several heartbeats per timeout, so that a late one does not fail a
+    // worker.
+    job.heartbeat = d_timeout.count() > 0 ? max<uint32_t>(d_timeout.count() / 4, 1) : 0;
+
+    deque<unsigned> pending;
+    for (Tile const &tile : tiles)
+        pending.push_back(tile.index);
+
+    // Several ranges per worker, so that a slow worker (or one that renders
+    // the expensive part of the image) does not hold up the others.
+    size_t rangeSize = max<size_t>(tiles.size() / (4 * max<size_t>(d_workers.size(), 1)), 1);
+
+    // Puts the tiles of a failed worker back in front of the queue.
+    auto reassign = [&](Worker &worker)
+    {
+        cerr << "Warning: worker " << worker.pid << " failed, reassigning its "
+             << worker.tiles.size() << " tiles.\n";
+        pending.insert(pending.begin(), worker.tiles.begin(), worker.tiles.end());
+        fail(worker);
+    };
+
+    for (Worker &worker : d_workers)
+    {
+        if (not writeAll(worker.socket, &job, sizeof(job)))
+            reassign(worker);
+    }
+
+    size_t remaining = tiles.size();
+    while (remaining > 0)
+    {
+        for (Worker &worker : d_workers)
+        {
+            if (worker.socket < 0 or not worker.tiles.empty() or pending.empty())
+                continue;
+
+            size_t count = min(rangeSize, pending.size());
+            vector<unsigned> range(pending.begin(), pending.begin() + count);
+            pending.erase(pending.begin(), pending.begin() + count);
+            if (not assign(worker, range))
+                reassign(worker);
+        }
+
+        vector<pollfd> descriptors;
+        vector<Worker *> busy;
+        chrono::steady_clock::time_point stall = chrono::steady_clock::time_point::max();
+        for (Worker &worker : d_workers)
+        {
+            if (worker.socket >= 0 and not worker.tiles.empty())
+            {
+                descriptors.push_back(pollfd{worker.socket, POLLIN, 0});
+                busy.push_back(&worker);
+                if (d_timeout.count() > 0)
+                    stall = min(stall, worker.progress + d_timeout);
+            }
+        }
+
+        // All workers failed, the remaining tiles are pending.
+        if (descriptors.empty())
+            break;
+
+        // Wait until the first busy worker would stall, rounded up to whole
+        // milliseconds so that it has stalled when the poll times out.
+        int timeout = -1;
+        if (stall != chrono::steady_clock::time_point::max())
+        {
+            auto wait = chrono::ceil<chrono::milliseconds>(stall - chrono::steady_clock::now());
+            timeout = static_cast<int>(max<chrono::milliseconds::rep>(wait.count(), 0));
+        }
+        if (poll(descriptors.data(), descriptors.size(), timeout) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            cerr << "Error: waiting for the workers failed.\n";
+            for (Worker *worker : busy)
+                reassign(*worker);
+            break;
+        }
+
+        for (size_t idx = 0; idx != descriptors.size(); ++idx)
+        {
+            if (descriptors[idx].revents == 0)
+                continue;
+
+            // A heartbeat leaves the tiles of the worker as they are.
+            size_t assigned = busy[idx]->tiles.size();
+            if (receive(*busy[idx], tiles, img, heatmap))
+                remaining -= assigned - busy[idx]->tiles.size();
+            else
+                reassign(*busy[idx]);
+        }
+
+        for (Worker *worker : busy)
+        {
+            if (worker->socket >= 0 and not worker->tiles.empty() and d_timeout.count() > 0
+                and chrono::steady_clock::now() >= worker->progress + d_timeout)
+            {
+                cerr << "Warning: worker " << worker->pid << " made no progress for "
+                     << d_timeout.count() / 1000.0 << " s.\n";
+                reassign(*worker);
+            }
+        }
+    }
+
+    return vector<unsigned>(pending.begin(), pending.end());
+}
+
+bool Coordinator::assign(Worker &worker, vector<unsigned> const &tiles)
+{
+    worker.tiles = tiles;
+    worker.progress = chrono::steady_clock::now();
+
+    uint32_t count = tiles.size();
+    vector<uint32_t> indices(tiles.begin(), tiles.end());
+    return writeAll(worker.socket, &count, sizeof(count))
+           and writeAll(worker.socket, indices.data(), indices.size() * sizeof(uint32_t));
+}
+
+// Reads one tile or heartbeat from the worker, false if the worker failed.
+bool Coordinator::receive(Worker &worker, vector<Tile> const &tiles, Framebuffer &img, Heatmap *heatmap)
+{
+    uint32_t index;
+    if (not readAll(worker.socket, &index, sizeof(index)))
+        return false;
+
+    if (index == heartbeat)
+    {
+        worker.progress = chrono::steady_clock::now();
+        return true;
+    }
+
+    auto assigned = find(worker.tiles.begin(), worker.tiles.end(), index);
+    if (assigned == worker.tiles.end())
+        return false;
+
+    Tile const &tile = tiles[index];
+    size_t pixelCount = static_cast<size_t>(tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+    vector<float> pixels(3 * pixelCount);
+    vector<uint64_t> costs(heatmap ? pixelCount : 0);
+    if (not readAll(worker.socket, pixels.data(), pixels.size() * sizeof(float))
+        or not readAll(worker.socket, costs.data(), costs.size() * sizeof(uint64_t)))
+        return false;
+
+    size_t pixel = 0;
+    for (unsigned y = tile.y0; y != tile.y1; ++y)
+    {
+        for (unsigned x = tile.x0; x != tile.x1; ++x, ++pixel)
+        {
+            img.put_pixel(x, y, Color(pixels[3 * pixel], pixels[3 * pixel + 1], pixels[3 * pixel + 2]));
+            if (heatmap)
+                (*heatmap)(x, y) = costs[pixel];
+        }
+    }
+
+    worker.tiles.erase(assigned);
+    worker.progress = chrono::steady_clock::now();
+    return true;
+}
+
+// Stops the worker, which may still be running if it sent garbage.
+void Coordinator::fail(Worker &worker)
+{
+    worker.tiles.clear();
+    if (worker.socket >= 0)
+        close(worker.socket);
+    worker.socket = -1;
+
+    if (worker.pid > 0)
+    {
+        kill(worker.pid, SIGKILL);
+        waitpid(worker.pid, nullptr, 0);
+    }
+    worker.pid = -1;
+}
@@ -0,0 +1,81 @@
+#ifndef DISTRIBUTED_H_
+#define DISTRIBUTED_H_
+
+#include "framebuffer.h"
+#include "heatmap.h"
+#include "tile_scheduler.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+// Settings of a render that the workers need besides the scene file, which
+// may have been overridden on the command line of the coordinator.
+struct Job
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t seed;
+    uint32_t threadCount;       // per worker
+    uint32_t heatmap;           // 0 for none, else 1 + the Heatmap::Metric
+    uint32_t packetSize;
+    uint32_t heartbeat;         // interval in milliseconds, 0 for none
+};
+
+// Renders the tiles of an image on worker processes. Every worker is a child
+// process connected by a local socket, which parses the scene file itself
+// with Raytracer::readScene. The coordinator hands out the tiles in ranges,
+// and the workers stream back every tile as soon as it is done. The tiles
+// of a worker that fails, or that makes no progress for the timeout, are
+// handed to the other workers. A worker whose render threads use processor
+// time sends heartbeats, so a slow tile does not count as a lack of progress.
+//
+// Messages, in native byte order:
+//     coordinator -> worker: the Job, once, then any number of assignments:
+//                            a uint32 count followed by count tile indices.
+//     worker -> coordinator: per tile its uint32 index, its pixels row by
+//                            row as 3 floats each and, if a heatmap is
+//                            made, the cost of every pixel as uint64; or
+//                            the uint32 0xffffffff as a heartbeat.
+// Closing the socket ends the worker.
+class Coordinator
+{
+    struct Worker
+    {
+        pid_t pid;
+        int socket;                     // -1 once the worker failed
+        std::vector<unsigned> tiles;    // assigned, but not received yet
+        std::chrono::steady_clock::time_point progress;     // last assignment, tile or heartbeat
+    };
+
+    std::vector<Worker> d_workers;
+    std::chrono::milliseconds d_timeout;    // 0 waits for the workers forever
+
+    public:
+        // Starts the worker processes, must be called before any threads
+        // are started.
+        Coordinator(std::string const &sceneFile, unsigned workerCount,
+                    std::chrono::milliseconds timeout);
+        ~Coordinator();
+
+        Coordinator(Coordinator const &) = delete;
+        Coordinator &operator=(Coordinator const &) = delete;
+
+        // Renders the tiles into img (and the heatmap, if any), once per
+        // Coordinator. The heartbeat of the job is derived from the timeout.
+        // Returns the indices of the tiles that could not be rendered
+        // because all workers failed.
+        std::vector<unsigned> render(Job job, std::vector<Tile> const &tiles,
+                                     Framebuffer &img, Heatmap *heatmap);
+
+    private:
+        bool assign(Worker &worker, std::vector<unsigned> const &tiles);
+        bool receive(Worker &worker, std::vector<Tile> const &tiles, Framebuffer &img,
+                     Heatmap *heatmap);
+        void fail(Worker &worker);
+};
+
+#endif
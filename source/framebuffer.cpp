@@ -0,0 +1,106 @@
+#include "framebuffer.h"
+
+#include "png_writer.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+Framebuffer::Framebuffer(unsigned width, unsigned height, unsigned blockSize)
+:
+    d_width(width),
+    d_height(height),
+    d_blockSize(max(blockSize, 4u)),
+    d_blocksPerRow((width + d_blockSize - 1) / d_blockSize),
+    d_linesPerBlock((3 * d_blockSize * d_blockSize + 15) / 16)
+{
+    size_t blocks = static_cast<size_t>(d_blocksPerRow) * ((height + d_blockSize - 1) / d_blockSize);
+    d_lines.resize(blocks * d_linesPerBlock, CacheLine{});
+}
+
+void Framebuffer::put_pixel(unsigned x, unsigned y, Color const &c)
+{
+    size_t first = offset(x, y);
+    for (unsigned idx = 0; idx != 3; ++idx)
+        channel(first + idx) = static_cast<float>(c.data[idx]);
+}
+
+Color Framebuffer::get_pixel(unsigned x, unsigned y) const
+{
+    size_t first = offset(x, y);
+    return Color(channel(first), channel(first + 1), channel(first + 2));
+}
+
+unsigned Framebuffer::width() const
+{
+    return d_width;
+}
+
+unsigned Framebuffer::height() const
+{
+    return d_height;
+}
+
+unsigned Framebuffer::size() const
+{
+    return d_width * d_height;
+}
+
+unsigned Framebuffer::blockSize() const
+{
+    return d_blockSize;
+}
+
+void Framebuffer::getRow(unsigned y, Color *pixels) const
+{
+    for (unsigned x = 0; x != d_width; ++x)
+        pixels[x] = get_pixel(x, y);
+}
+
+Image Framebuffer::toImage() const
+{
+    Image img(d_width, d_height);
+    for (unsigned y = 0; y != d_height; ++y)
+        for (unsigned x = 0; x != d_width; ++x)
+            img(x, y) = get_pixel(x, y);
+    return img;
+}
+
+bool Framebuffer::write_png(string const &filename) const
+{
+    PngWriter png(filename, d_width, d_height);
+    vector<Color> row(d_width);
+    for (unsigned y = 0; y != d_height; ++y)
+    {
+        getRow(y, row.data());
+        png.writeRow(row.data());
+    }
+
+    if (not png.finish())
+    {
+        cerr << "Error: could not write " << filename << ".\n";
+        return false;
+    }
+    return true;
+}
+
+// Position of the first channel of a pixel, counted in floats. The three
+// channels are consecutive, a pixel may continue on the next cache line of
+// its block.
+size_t Framebuffer::offset(unsigned x, unsigned y) const
+{
+    size_t block = static_cast<size_t>(y / d_blockSize) * d_blocksPerRow + x / d_blockSize;
+    unsigned pixel = (y % d_blockSize) * d_blockSize + x % d_blockSize;
+    return 16 * block * d_linesPerBlock + 3 * pixel;
+}
+
+float &Framebuffer::channel(size_t offset)
+{
+    return d_lines[offset / 16].channels[offset % 16];
+}
+
+float Framebuffer::channel(size_t offset) const
+{
+    return d_lines[offset / 16].channels[offset % 16];
+}
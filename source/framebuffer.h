@@ -0,0 +1,61 @@
+#ifndef FRAMEBUFFER_H_
+#define FRAMEBUFFER_H_
+
+#include "image.h"
+#include "triple.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// The render target of Scene::render. Pixels are kept as three floats, half
+// the memory of the doubles of an Image, which the 8 bit output does not
+// need. The image is stored in square blocks of pixels, row by row within a
+// block, and every block starts on a cache line of its own. With blocks the
+// size of the render tiles, every thread writes to its own memory, without
+// sharing cache lines with the tiles of other threads.
+//
+// Use toImage for an Image, e.g. to process the result further.
+class Framebuffer
+{
+    struct alignas(64) CacheLine
+    {
+        float channels[16];
+    };
+
+    std::vector<CacheLine> d_lines;
+    unsigned d_width;
+    unsigned d_height;
+    unsigned d_blockSize;       // pixels per side
+    unsigned d_blocksPerRow;
+    unsigned d_linesPerBlock;
+
+    public:
+        // Blocks smaller than 4 x 4 pixels would waste most of their cache
+        // lines, they are enlarged.
+        Framebuffer(unsigned width = 0, unsigned height = 0, unsigned blockSize = 32);
+
+        // The color is rounded to float precision.
+        void put_pixel(unsigned x, unsigned y, Color const &c);
+        Color get_pixel(unsigned x, unsigned y) const;
+
+        // The width pixels of row y.
+        void getRow(unsigned y, Color *pixels) const;
+
+        unsigned width() const;
+        unsigned height() const;
+        unsigned size() const;
+        unsigned blockSize() const;
+
+        Image toImage() const;
+
+        // As Image::write_png, without converting to an Image first.
+        bool write_png(std::string const &filename) const;
+
+    private:
+        size_t offset(unsigned x, unsigned y) const;
+        float &channel(size_t offset);
+        float channel(size_t offset) const;
+};
+
+#endif
@@ -0,0 +1,120 @@
+#include "heatmap.h"
+
+#include "statistics.h"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+namespace
+{
+    // Colour ramp through dark blue, cyan, green, yellow and red.
+    Color ramp(double value)
+    {
+        static Color const stops[] = {
+            Color(0.0, 0.0, 0.3),
+            Color(0.0, 0.8, 1.0),
+            Color(0.1, 0.9, 0.1),
+            Color(1.0, 0.9, 0.0),
+            Color(0.9, 0.0, 0.0)
+        };
+        size_t const intervals = sizeof(stops) / sizeof(stops[0]) - 1;
+
+        double position = clamp(value, 0.0, 1.0) * intervals;
+        size_t interval = min(static_cast<size_t>(position), intervals - 1);
+        double fraction = position - interval;
+        return (1.0 - fraction) * stops[interval] + fraction * stops[interval + 1];
+    }
+}
+
+Heatmap::Heatmap(unsigned width, unsigned height, Metric metric)
+:
+    d_cost(width * height),
+    d_width(width),
+    d_height(height),
+    d_metric(metric)
+{}
+
+uint64_t &Heatmap::operator()(unsigned x, unsigned y)
+{
+    return d_cost[y * d_width + x];
+}
+
+uint64_t Heatmap::operator()(unsigned x, unsigned y) const
+{
+    return d_cost[y * d_width + x];
+}
+
+uint64_t Heatmap::counter() const
+{
+    switch (d_metric)
+    {
+        case Metric::MarchSteps:
+            return Statistics::local().marchSteps;
+
+        case Metric::IntersectionTests:
+        {
+            uint64_t tests = 0;
+            for (auto const &entry : Statistics::local().intersectionTests)
+                tests += entry.second;
+            return tests;
+        }
+
+        case Metric::Time:
+        default:
+            return chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+Image Heatmap::toImage(uint64_t &scale) const
+{
+    // A few very expensive pixels should not turn the rest of the map blue.
+    scale = 0;
+    if (not d_cost.empty())
+    {
+        vector<uint64_t> sorted(d_cost);
+        auto percentile = sorted.begin() + (sorted.size() - 1) * 99 / 100;
+        nth_element(sorted.begin(), percentile, sorted.end());
+        scale = *percentile;
+    }
+
+    Image img(d_width, d_height);
+    for (unsigned y = 0; y != d_height; ++y)
+        for (unsigned x = 0; x != d_width; ++x)
+            img(x, y) = ramp(scale == 0 ? 0.0 : static_cast<double>(d_cost[y * d_width + x]) / scale);
+    return img;
+}
+
+Heatmap::Metric Heatmap::metric() const
+{
+    return d_metric;
+}
+
+bool Heatmap::parseMetric(string const &name, Metric &metric)
+{
+    if (name == "time")
+        metric = Metric::Time;
+    else if (name == "steps")
+        metric = Metric::MarchSteps;
+    else if (name == "tests")
+        metric = Metric::IntersectionTests;
+    else
+        return false;
+    return true;
+}
+
+string Heatmap::unit(Metric metric)
+{
+    switch (metric)
+    {
+        case Metric::MarchSteps:
+            return "march steps";
+        case Metric::IntersectionTests:
+            return "intersection tests";
+        case Metric::Time:
+        default:
+            return "ns";
+    }
+}
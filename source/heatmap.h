@@ -0,0 +1,48 @@
+#ifndef HEATMAP_H_
+#define HEATMAP_H_
+
+#include "image.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Cost of rendering every pixel of an image, see Scene::render. The cost of
+// a pixel is the increase of counter() while rendering it.
+class Heatmap
+{
+    public:
+        enum class Metric
+        {
+            Time,               // nanoseconds
+            MarchSteps,         // requires RAYTRACER_STATISTICS
+            IntersectionTests   // requires RAYTRACER_STATISTICS
+        };
+
+    private:
+        std::vector<uint64_t> d_cost;
+        unsigned d_width;
+        unsigned d_height;
+        Metric d_metric;
+
+    public:
+        Heatmap(unsigned width, unsigned height, Metric metric);
+
+        uint64_t &operator()(unsigned x, unsigned y);
+        uint64_t operator()(unsigned x, unsigned y) const;
+
+        // Current value of the metric on the calling thread.
+        uint64_t counter() const;
+
+        // Maps the costs to a colour ramp from dark blue (no cost) to red.
+        // Costs at or above the returned scale, the 99th percentile, are red.
+        Image toImage(uint64_t &scale) const;
+
+        Metric metric() const;
+
+        // "time", "steps" or "tests", returns false for anything else.
+        static bool parseMetric(std::string const &name, Metric &metric);
+        static std::string unit(Metric metric);
+};
+
+#endif
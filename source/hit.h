@@ -7,15 +7,29 @@
 class Hit
 {
     public:
-        double t;   // distance of hit
-        Vector N;   // Normal at hit
+        double t;           // distance of hit
+        Vector N;           // Normal at hit, only valid if hasNormal
+        bool hasNormal;     // false for deferred hits, see Object::normal
+        Point position;     // Where a deferred normal is to be evaluated
 
         Hit(double time, Vector const &normal)
         :
             t(time),
-            N(normal)
+            N(normal),
+            hasNormal(true),
+            position()
         {}
 
+        // Hit without a normal. Objects whose normals are expensive return
+        // these, so only the closest hit along a ray pays for its normal.
+        static Hit deferred(double time, Point const &position)
+        {
+            Hit hit(time, Vector());
+            hit.hasNormal = false;
+            hit.position = position;
+            return hit;
+        }
+
         static Hit const NO_HIT()
         {
             static Hit no_hit(std::numeric_limits<double>::quiet_NaN(),
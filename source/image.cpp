@@ -1,5 +1,7 @@
 #include "image.h"
 
+#include "png_writer.h"
+
 #include "lode/lodepng.h"
 #include <iostream>
 #include <fstream>
@@ -62,19 +64,18 @@ Color const &Image::colorAt(float x, float y) const
     return d_pixels.at(findex(x, y));
 }
 
-void Image::write_png(std::string const &filename) const
+bool Image::write_png(std::string const &filename) const
 {
-    vector<unsigned char> image;
-    image.reserve(size() * 4);  // reserves size (less allocations)
-    for (Color pixel : d_pixels)
+    PngWriter png(filename, d_width, d_height);
+    for (unsigned y = 0; y != d_height; ++y)
+        png.writeRow(d_pixels.data() + index(0, y));
+
+    if (not png.finish())
     {
-        image.push_back(static_cast<unsigned char>(pixel.r * 255.0));
-        image.push_back(static_cast<unsigned char>(pixel.g * 255.0));
-        image.push_back(static_cast<unsigned char>(pixel.b * 255.0));
-        image.push_back(255);   // alpha is always 1
+        cerr << "Error: could not write " << filename << ".\n";
+        return false;
     }
-
-    lodepng::encode(filename, image, d_width, d_height);
+    return true;
 }
 
 void Image::read_png(std::string const &filename)
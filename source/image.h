@@ -34,7 +34,7 @@ class Image
         // usefull for texture access
         Color const &colorAt(float x, float y) const;
 
-        void write_png(std::string const &filename) const;
+        bool write_png(std::string const &filename) const;     // false on failure
         void read_png(std::string const &filename);
 
     private:
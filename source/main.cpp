@@ -1,44 +1,170 @@
+#include "png_writer.h"
+#include "primitive_arrays.h"
 #include "raytracer.h"
 
 #include <iostream>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
 using namespace std;
 
+namespace
+{
+    // Parses the whole of text as a number, false if it is not one (or
+    // out of range).
+    bool parseNumber(string const &text, long &value)
+    {
+        try
+        {
+            size_t end;
+            value = stol(text, &end);
+            return end == text.size();
+        }
+        catch (logic_error const &)     // invalid_argument or out_of_range
+        {
+            return false;
+        }
+    }
+
+    bool parseNumber(string const &text, double &value)
+    {
+        try
+        {
+            size_t end;
+            value = stod(text, &end);
+            return end == text.size();
+        }
+        catch (logic_error const &)
+        {
+            return false;
+        }
+    }
+}
+
 int main(int argc, char *argv[])
 {
     cout << "Computer Graphics - Ray tracer\n\n";
 
-    if (argc < 2 || argc > 3)
+    // Split the arguments into options and file names.
+    vector<string> files;
+    long threads = -1;
+    long seed = -1;
+    string statisticsFile;
+    string heatmapMetric;
+    double timeBudget = 0.0;
+    string checkpointFile;
+    double checkpointInterval = 60.0;
+    long workers = 0;
+    double workerTimeout = 300.0;
+    string kernelName;
+    long packetSize = 0;
+    long pngLevel = -1;
+    bool valid = true;
+    for (int idx = 1; idx < argc; ++idx)
     {
-        cerr << "Usage: " << argv[0] << " in-file [out-file.png]\n";
+        string arg = argv[idx];
+        if (arg == "--threads" and idx + 1 < argc)
+            valid = parseNumber(argv[++idx], threads) and valid;
+        else if (arg == "--seed" and idx + 1 < argc)
+            valid = parseNumber(argv[++idx], seed) and valid;
+        else if (arg == "--statistics" and idx + 1 < argc)
+            statisticsFile = argv[++idx];
+        else if (arg == "--heatmap" and idx + 1 < argc)
+            heatmapMetric = argv[++idx];
+        else if (arg == "--time-budget" and idx + 1 < argc)
+            valid = parseNumber(argv[++idx], timeBudget) and valid;
+        else if (arg == "--checkpoint" and idx + 1 < argc)
+            checkpointFile = argv[++idx];
+        else if (arg == "--checkpoint-interval" and idx + 1 < argc)
+            valid = parseNumber(argv[++idx], checkpointInterval) and valid;
+        else if (arg == "--workers" and idx + 1 < argc)
+            valid = parseNumber(argv[++idx], workers) and valid;
+        else if (arg == "--worker-timeout" and idx + 1 < argc)
+            valid = parseNumber(argv[++idx], workerTimeout) and valid;
+        else if (arg == "--kernel" and idx + 1 < argc)
+            kernelName = argv[++idx];
+        else if (arg == "--packet-size" and idx + 1 < argc)
+            valid = parseNumber(argv[++idx], packetSize) and valid;
+        else if (arg == "--png-level" and idx + 1 < argc)
+            valid = parseNumber(argv[++idx], pngLevel) and valid;
+        else
+            files.push_back(arg);
+    }
+
+    Heatmap::Metric metric;
+    PrimitiveArrays::Kernel kernel;
+    if (not valid || files.size() < 1 || files.size() > 2 || threads < -1 || seed < -1 ||
+        timeBudget < 0.0 || checkpointInterval < 0.0 || workers < 0 || workerTimeout < 0.0 ||
+        packetSize < 0 || packetSize == 3 || packetSize > 4 || pngLevel < -1 || pngLevel > 9 ||
+        (not heatmapMetric.empty() and not Heatmap::parseMetric(heatmapMetric, metric)) ||
+        (not kernelName.empty() and not PrimitiveArrays::parseKernel(kernelName, kernel)))
+    {
+        cerr << "Usage: " << argv[0] << " in-file [out-file.png]"
+                " [--threads N] [--seed N] [--statistics file.json]"
+                " [--heatmap time|steps|tests] [--time-budget seconds]"
+                " [--checkpoint file [--checkpoint-interval seconds]]"
+                " [--workers N [--worker-timeout seconds]]"
+                " [--kernel scalar|sse4|avx2] [--packet-size 1|2|4] [--png-level 0-9]\n";
         return 1;
     }
 
+    if (not kernelName.empty() and not PrimitiveArrays::setKernel(kernel))
+        cerr << "Warning: the CPU does not support the " << kernelName << " kernel, using "
+             << PrimitiveArrays::kernelName(PrimitiveArrays::kernel()) << ".\n";
+
+    if (pngLevel != -1)
+        PngWriter::setCompressionLevel(pngLevel);
+
     Raytracer raytracer;
 
     // read the scene
-    if (!raytracer.readScene(argv[1]))
+    if (!raytracer.readScene(files[0]))
     {
-        cerr << "Error: reading scene from " << argv[1] <<
+        cerr << "Error: reading scene from " << files[0] <<
             " failed - no output generated.\n";
         return 1;
     }
 
+    // command line options take precedence over the scene file
+    if (threads != -1)
+        raytracer.setThreadCount(threads);
+    if (seed != -1)
+        raytracer.setSeed(seed);
+    if (not heatmapMetric.empty())
+        raytracer.setHeatmap(metric);
+    if (timeBudget > 0.0)
+        raytracer.setTimeBudget(timeBudget);
+    if (not checkpointFile.empty())
+        raytracer.setCheckpoint(checkpointFile, checkpointInterval);
+    if (workers > 0)
+        raytracer.setWorkerCount(workers, workerTimeout);
+    if (packetSize > 0)
+        raytracer.setPacketSize(packetSize);
+
     // determine output name
     string ofname;
-    if (argc >= 3)
+    if (files.size() >= 2)
     {
-        ofname = argv[2];   // use the provided name
+        ofname = files[1];  // use the provided name
     }
     else
     {
-        ofname = argv[1];   // replace .json with .png
+        ofname = files[0];  // replace .json with .png
         ofname.erase(ofname.begin() + ofname.find_last_of('.'), ofname.end());
         ofname += ".png";
     }
 
     raytracer.renderToFile(ofname);
 
+    if (not statisticsFile.empty())
+    {
+        if (Statistics::enabled)
+            raytracer.writeStatistics(statisticsFile);
+        else
+            cerr << "Warning: statistics are not compiled in, configure with"
+                    " -DRAYTRACER_STATISTICS=ON.\n";
+    }
+
     return 0;
 }
@@ -4,8 +4,10 @@
 #include "material.h"
 
 // not really needed here, but deriving classes may need them
+#include "bounding_box.h"
 #include "hit.h"
 #include "ray.h"
+#include "ray_packet.h"
 #include "triple.h"
 
 #include <memory>
@@ -22,6 +24,49 @@ class Object
         virtual Hit intersect(Ray const &ray) = 0;  // must be implemented
                                                     // in derived class
 
+        // intersect for the lanes of the packet in mask. Lanes that hit the
+        // object before minHits[lane].t update it, and are returned. Objects
+        // that trace coherent rays faster together override this.
+        virtual RayPacket::Mask intersectPacket(RayPacket const &packet, RayPacket::Mask mask,
+                                                Hit *minHits)
+        {
+            RayPacket::Mask closer = 0;
+            for (unsigned lane = 0; lane != packet.size; ++lane)
+            {
+                if (not (mask >> lane & 1))
+                    continue;
+
+                Hit hit(intersect(*packet.rays[lane]));
+                if (hit.t < minHits[lane].t)
+                {
+                    minHits[lane] = hit;
+                    closer |= RayPacket::Mask(1) << lane;
+                }
+            }
+            return closer;
+        }
+
+        // Normal at a hit returned by intersect. Objects returning deferred
+        // hits override this to evaluate the normal on demand.
+        virtual Vector normal(Hit const &hit)
+        {
+            return hit.N;
+        }
+
+        // Whether the ray hits the object at a distance below maxT. Unlike
+        // intersect this may return at the first hit found and skips the normal.
+        virtual bool occludes(Ray const &ray, double maxT)
+        {
+            return intersect(ray).t < maxT;
+        }
+
+        // Axis aligned box containing the object. Objects without a finite
+        // extent keep this default and are tested outside of the BVH.
+        virtual BoundingBox bounds()
+        {
+            return BoundingBox::UNBOUNDED();
+        }
+
         virtual Vector toUV(Point const &hit)
         {
             // bogus implementation
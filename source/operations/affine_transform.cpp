@@ -0,0 +1,42 @@
+#include "affine_transform.h"
+
+using namespace std;
+
+AffineTransform::AffineTransform()
+:
+    row1(1.0, 0.0, 0.0),
+    row2(0.0, 1.0, 0.0),
+    row3(0.0, 0.0, 1.0),
+    offset(0.0, 0.0, 0.0)
+{}
+
+void AffineTransform::append(Vector const &nextRow1, Vector const &nextRow2, Vector const &nextRow3,
+                             Vector const &nextOffset)
+{
+    // next(this(p)) = next * row * p + next * offset + nextOffset.
+    Vector result1 = nextRow1.x * row1 + nextRow1.y * row2 + nextRow1.z * row3;
+    Vector result2 = nextRow2.x * row1 + nextRow2.y * row2 + nextRow2.z * row3;
+    Vector result3 = nextRow3.x * row1 + nextRow3.y * row2 + nextRow3.z * row3;
+
+    offset = Vector(nextRow1.dot(offset), nextRow2.dot(offset), nextRow3.dot(offset)) + nextOffset;
+    row1 = result1;
+    row2 = result2;
+    row3 = result3;
+}
+
+void AffineTransform::tranformPosition(Point &position)
+{
+    position = Point(position.dot(row1), position.dot(row2), position.dot(row3)) + offset;
+}
+
+void AffineTransform::tranformGradient(Vector &gradient)
+{
+    // Multiplication by the transposed matrix, see Rotate::tranformGradient.
+    gradient = gradient.x * row1 + gradient.y * row2 + gradient.z * row3;
+}
+
+bool AffineTransform::tranformAffine(AffineTransform &transform)
+{
+    transform.append(row1, row2, row3, offset);
+    return true;
+}
@@ -0,0 +1,25 @@
+#ifndef AFFINE_TRANSFORM_H_
+#define AFFINE_TRANSFORM_H_
+
+#include "operation.h"
+
+// Maps positions to row * position + offset. Chains of affine operations
+// are folded into one of these, see Operation::tranformAffine.
+class AffineTransform : public Operation
+{
+public:
+    Vector row1, row2, row3;
+    Vector offset;
+
+    AffineTransform();  // identity
+
+    // Applies the given transformation after this one.
+    void append(Vector const &nextRow1, Vector const &nextRow2, Vector const &nextRow3,
+                Vector const &nextOffset);
+
+    void tranformPosition(Point &position) override;
+    void tranformGradient(Vector &gradient) override;
+    bool tranformAffine(AffineTransform &transform) override;
+};
+
+#endif
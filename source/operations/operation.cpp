@@ -1,5 +1,7 @@
 #include "operation.h"
 
+#include "affine_transform.h"
+
 using namespace std;
 
 // Default operation is identity.
@@ -9,3 +11,19 @@ void Operation::tranformPosition(Point &position)
 // Default operation is identity.
 void Operation::tranformDistance(double &distance)
 {}
+
+// Translations, uniform scales and repetitions preserve gradient directions.
+void Operation::tranformGradient(Vector &gradient)
+{}
+
+// Default operation is identity.
+bool Operation::tranformBounds(Point &center, double &radius)
+{
+    return true;
+}
+
+// Default operation is identity.
+bool Operation::tranformAffine(AffineTransform &transform)
+{
+    return true;
+}
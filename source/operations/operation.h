@@ -5,11 +5,26 @@
 
 #include <iostream>
 
+class AffineTransform;
+
 class Operation
 {
 public:
     virtual void tranformPosition(Point &position);
     virtual void tranformDistance(double &distance);
+
+    // Maps a gradient of the transformed distance field back to a gradient
+    // in the untransformed space, up to a positive scale factor.
+    virtual void tranformGradient(Vector &gradient);
+
+    // Maps a bounding sphere of the transformed shape to a bounding sphere
+    // of the untransformed shape. Returns false if the result is unbounded.
+    virtual bool tranformBounds(Point &center, double &radius);
+
+    // Operations whose position transformation is affine append it to the
+    // transform and return true. Their distance transformation must then be
+    // a multiplication by a constant.
+    virtual bool tranformAffine(AffineTransform &transform);
 };
 
 #endif
@@ -24,3 +24,15 @@ void Repeat::tranformPosition(Point &position)
     if (period.z != 0.0)
         position.z = mod(position.z + 0.5 * period.z, period.z) - 0.5 * period.z;
 }
+
+bool Repeat::tranformBounds(Point &center, double &radius)
+{
+    // Repeating along any axis makes the shape infinitely large.
+    return period.x == 0.0 and period.y == 0.0 and period.z == 0.0;
+}
+
+bool Repeat::tranformAffine(AffineTransform &transform)
+{
+    // Only affine if nothing is repeated.
+    return period.x == 0.0 and period.y == 0.0 and period.z == 0.0;
+}
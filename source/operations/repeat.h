@@ -11,6 +11,8 @@ public:
     Repeat(Vector const &period);
 
     void tranformPosition(Point &position) override;
+    bool tranformBounds(Point &center, double &radius) override;
+    bool tranformAffine(AffineTransform &transform) override;
 };
 
 #endif
@@ -1,5 +1,7 @@
 #include "rotate.h"
 
+#include "affine_transform.h"
+
 #include <cmath>
 
 using namespace std;
@@ -56,3 +58,28 @@ void Rotate::tranformPosition(Point &position)
     result.z = position.dot(xRow3);
     position = result;
 }
+
+void Rotate::tranformGradient(Vector &gradient)
+{
+    // Multiply by the transposed matrices in reverse order, which undoes
+    // the rotation applied to positions. (Multiplication by rotation matrix).
+    gradient = gradient.x * xRow1 + gradient.y * xRow2 + gradient.z * xRow3;
+    gradient = gradient.x * yRow1 + gradient.y * yRow2 + gradient.z * yRow3;
+    gradient = gradient.x * zRow1 + gradient.y * zRow2 + gradient.z * zRow3;
+}
+
+bool Rotate::tranformBounds(Point &center, double &radius)
+{
+    // The center is rotated forwards, just like gradients.
+    tranformGradient(center);
+    return true;
+}
+
+bool Rotate::tranformAffine(AffineTransform &transform)
+{
+    // Same order as tranformPosition.
+    transform.append(zRow1, zRow2, zRow3, Vector());
+    transform.append(yRow1, yRow2, yRow3, Vector());
+    transform.append(xRow1, xRow2, xRow3, Vector());
+    return true;
+}
@@ -11,6 +11,9 @@ public:
     Rotate(Vector const &rotation);
 
     void tranformPosition(Point &position) override;
+    void tranformGradient(Vector &gradient) override;
+    bool tranformBounds(Point &center, double &radius) override;
+    bool tranformAffine(AffineTransform &transform) override;
 
 private:
     Vector xRow1, xRow2, xRow3;
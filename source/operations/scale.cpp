@@ -1,5 +1,7 @@
 #include "scale.h"
 
+#include "affine_transform.h"
+
 #include <iostream>
 
 using namespace std;
@@ -18,3 +20,19 @@ void Scale::tranformDistance(double &distance)
 {
     distance *= scale;
 }
+
+bool Scale::tranformBounds(Point &center, double &radius)
+{
+    center *= scale;
+    radius *= scale;
+    return true;
+}
+
+bool Scale::tranformAffine(AffineTransform &transform)
+{
+    transform.append(Vector(1.0 / scale, 0.0, 0.0),
+                     Vector(0.0, 1.0 / scale, 0.0),
+                     Vector(0.0, 0.0, 1.0 / scale),
+                     Vector());
+    return true;
+}
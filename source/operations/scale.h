@@ -8,10 +8,12 @@ class Scale : public Operation
 public:
     double scale;
 
-    Scale(double scale);
+    Scale(double scale);    // scale > 0
 
     void tranformPosition(Point &position) override;
     void tranformDistance(double &distance) override;
+    bool tranformBounds(Point &center, double &radius) override;
+    bool tranformAffine(AffineTransform &transform) override;
 };
 
 #endif
@@ -1,5 +1,7 @@
 #include "translate.h"
 
+#include "affine_transform.h"
+
 using namespace std;
 
 Translate::Translate(Vector const &translation)
@@ -11,3 +13,18 @@ void Translate::tranformPosition(Point &position)
 {
     position -= translation;
 }
+
+bool Translate::tranformBounds(Point &center, double &radius)
+{
+    center += translation;
+    return true;
+}
+
+bool Translate::tranformAffine(AffineTransform &transform)
+{
+    transform.append(Vector(1.0, 0.0, 0.0),
+                     Vector(0.0, 1.0, 0.0),
+                     Vector(0.0, 0.0, 1.0),
+                     -translation);
+    return true;
+}
@@ -11,6 +11,8 @@ public:
     Translate(Vector const &translation);
 
     void tranformPosition(Point &position) override;
+    bool tranformBounds(Point &center, double &radius) override;
+    bool tranformAffine(AffineTransform &transform) override;
 };
 
 #endif
@@ -0,0 +1,405 @@
+#include "png_writer.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include <zlib.h>
+
+using namespace std;
+
+namespace
+{
+    uint8_t const signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+
+    // Settings of new writers.
+    int defaultLevel = 6;           // as zlib
+    unsigned defaultThreadCount = 0;
+
+    // Filter types of the rows, see the PNG specification.
+    enum Filter : uint8_t
+    {
+        None,
+        Sub,
+        Up,
+        Average,
+        Paeth
+    };
+
+    uint8_t paethPredictor(int left, int up, int upLeft)
+    {
+        int estimate = left + up - upLeft;
+        int toLeft = abs(estimate - left);
+        int toUp = abs(estimate - up);
+        int toUpLeft = abs(estimate - upLeft);
+        if (toLeft <= toUp and toLeft <= toUpLeft)
+            return left;
+        return toUp <= toUpLeft ? up : upLeft;
+    }
+
+    // Filters the RGB row of size bytes below previous into filtered, the
+    // filter type followed by size bytes. Takes the filter with the
+    // smallest sum of absolute (signed) differences, the usual heuristic
+    // for photographic images, see the PNG specification. The candidate
+    // has the size of filtered.
+    void filterRow(uint8_t const *previous, uint8_t const *current, size_t size,
+                   vector<uint8_t> &filtered, vector<uint8_t> &candidate)
+    {
+        uint64_t bestSum = UINT64_MAX;
+        for (uint8_t filter = None; filter <= Paeth; ++filter)
+        {
+            candidate[0] = filter;
+            uint8_t *output = candidate.data() + 1;
+            size_t first = min<size_t>(3, size);    // the first pixel has no left neighbour
+            switch (filter)
+            {
+                case None:
+                    copy(current, current + size, output);
+                    break;
+                case Sub:
+                    copy(current, current + first, output);
+                    for (size_t idx = first; idx != size; ++idx)
+                        output[idx] = current[idx] - current[idx - 3];
+                    break;
+                case Up:
+                    for (size_t idx = 0; idx != size; ++idx)
+                        output[idx] = current[idx] - previous[idx];
+                    break;
+                case Average:
+                    for (size_t idx = 0; idx != first; ++idx)
+                        output[idx] = current[idx] - previous[idx] / 2;
+                    for (size_t idx = first; idx != size; ++idx)
+                        output[idx] = current[idx] - (current[idx - 3] + previous[idx]) / 2;
+                    break;
+                default:
+                    for (size_t idx = 0; idx != first; ++idx)
+                        output[idx] = current[idx] - previous[idx];
+                    for (size_t idx = first; idx != size; ++idx)
+                        output[idx] = current[idx] - paethPredictor(current[idx - 3], previous[idx],
+                                                                    previous[idx - 3]);
+                    break;
+            }
+
+            uint64_t sum = 0;
+            for (size_t idx = 0; idx != size; ++idx)
+                sum += output[idx] < 128 ? output[idx] : 256 - output[idx];
+
+            if (sum < bestSum)
+            {
+                bestSum = sum;
+                filtered.swap(candidate);
+            }
+        }
+    }
+
+    // Threads that compress the blocks of all writers. They are started when
+    // first needed and kept until the program ends, rather than started for
+    // every set of blocks.
+    class CompressionPool
+    {
+        std::mutex d_runMutex;              // held by the one run
+        std::mutex d_mutex;
+        std::condition_variable d_queued;
+        std::condition_variable d_done;
+        std::deque<std::function<void()>> d_jobs;
+        size_t d_running = 0;               // queued or being run
+        std::vector<std::thread> d_threads;
+        bool d_stopping = false;
+
+        public:
+            static CompressionPool &instance()
+            {
+                static CompressionPool pool;
+                return pool;
+            }
+
+            ~CompressionPool()
+            {
+                {
+                    lock_guard<mutex> lock(d_mutex);
+                    d_stopping = true;
+                }
+                d_queued.notify_all();
+                for (thread &worker : d_threads)
+                    worker.join();
+            }
+
+            // Runs the jobs on the calling thread and on as many pool
+            // threads as there are other jobs, and returns once all are
+            // done. One set of jobs runs at a time.
+            void run(vector<function<void()>> &jobs)
+            {
+                lock_guard<mutex> running(d_runMutex);
+                unique_lock<mutex> lock(d_mutex);
+                while (d_threads.size() + 1 < jobs.size())
+                    d_threads.emplace_back([this]() { work(); });
+
+                for (size_t idx = 1; idx < jobs.size(); ++idx)
+                    d_jobs.push_back(move(jobs[idx]));
+                d_running = d_jobs.size();
+                lock.unlock();
+                d_queued.notify_all();
+
+                if (not jobs.empty())
+                    jobs[0]();
+
+                lock.lock();
+                d_done.wait(lock, [this]() { return d_running == 0; });
+            }
+
+        private:
+            void work()
+            {
+                unique_lock<mutex> lock(d_mutex);
+                while (true)
+                {
+                    d_queued.wait(lock, [this]() { return d_stopping or not d_jobs.empty(); });
+                    if (d_jobs.empty())     // stopping
+                        return;
+
+                    function<void()> job = move(d_jobs.front());
+                    d_jobs.pop_front();
+                    lock.unlock();
+                    job();
+                    lock.lock();
+
+                    if (--d_running == 0)
+                        d_done.notify_all();
+                }
+            }
+    };
+
+    void putUint32(uint8_t *destination, uint32_t value)
+    {
+        destination[0] = value >> 24;
+        destination[1] = value >> 16;
+        destination[2] = value >> 8;
+        destination[3] = value;
+    }
+}
+
+void PngWriter::setCompressionLevel(int level)
+{
+    defaultLevel = min(max(level, 0), 9);
+}
+
+int PngWriter::compressionLevel()
+{
+    return defaultLevel;
+}
+
+void PngWriter::setThreadCount(unsigned count)
+{
+    defaultThreadCount = count;
+}
+
+unsigned PngWriter::threadCount()
+{
+    return defaultThreadCount;
+}
+
+PngWriter::PngWriter(string const &filename, unsigned width, unsigned height,
+                     unsigned threadCount)
+:
+    d_file(filename, ios::binary | ios::trunc),
+    d_width(width),
+    d_height(height),
+    d_level(defaultLevel),
+    d_threadCount(threadCount == 0 ? max(thread::hardware_concurrency(), 1u) : threadCount),
+    d_previous(rowSize(), 0),     // the row above the first is 0
+    d_checksum(1)                 // Adler-32 of nothing
+{
+    d_chunk.reserve(chunkSize);
+
+    // 8 bits per channel, RGB, no interlacing.
+    uint8_t header[13] = {};
+    putUint32(header, width);
+    putUint32(header + 4, height);
+    header[8] = 8;
+    header[9] = 2;
+
+    d_file.write(reinterpret_cast<char const *>(signature), sizeof(signature));
+    writeChunk("IHDR", header, sizeof(header));
+
+    // The zlib header: deflate with a 32 KiB window, and a level hint.
+    uint8_t levelHint = d_level < 2 ? 0 : d_level < 6 ? 1 : d_level == 6 ? 2 : 3;
+    uint8_t streamHeader[2] = {0x78, static_cast<uint8_t>(levelHint << 6)};
+    streamHeader[1] += (31 - (streamHeader[0] * 256 + streamHeader[1]) % 31) % 31;
+    append(streamHeader, sizeof(streamHeader));
+}
+
+void PngWriter::writeRow(Color const *pixels)
+{
+    size_t rowsPerBlock = max<size_t>(blockSize / (1 + rowSize()), 1);
+    if (d_blocks.empty() or d_blocks.back().rows.size() == rowsPerBlock * rowSize())
+    {
+        if (d_blocks.size() == d_threadCount)
+            compressBlocks();
+        d_blocks.emplace_back();
+        d_blocks.back().rows.reserve(rowsPerBlock * rowSize());
+    }
+
+    vector<uint8_t> &rows = d_blocks.back().rows;
+    for (unsigned x = 0; x != d_width; ++x)
+    {
+        rows.push_back(static_cast<unsigned char>(pixels[x].r * 255.0));
+        rows.push_back(static_cast<unsigned char>(pixels[x].g * 255.0));
+        rows.push_back(static_cast<unsigned char>(pixels[x].b * 255.0));
+    }
+    ++d_rows;
+}
+
+bool PngWriter::finish()
+{
+    // The last block ends the stream, it may be empty.
+    if (d_blocks.empty())
+        d_blocks.emplace_back();
+    d_blocks.back().last = true;
+    compressBlocks();
+
+    uint8_t trailer[4];
+    putUint32(trailer, d_checksum);
+    append(trailer, sizeof(trailer));
+    writeChunk("IDAT", d_chunk.data(), d_chunk.size());
+    d_chunk.clear();
+    writeChunk("IEND", nullptr, 0);
+
+    d_file.close();
+    return d_file.good() and not d_failed and d_rows == d_height;
+}
+
+// Bytes of an unfiltered row.
+size_t PngWriter::rowSize() const
+{
+    return 3 * static_cast<size_t>(d_width);
+}
+
+// Compresses the collected blocks, one per thread of the compression pool,
+// and appends them to the stream in order.
+void PngWriter::compressBlocks()
+{
+    vector<vector<uint8_t>> previous(d_blocks.size());
+    previous[0] = d_previous;
+    for (size_t idx = 1; idx != d_blocks.size(); ++idx)
+    {
+        vector<uint8_t> const &rows = d_blocks[idx - 1].rows;
+        previous[idx].assign(rows.end() - rowSize(), rows.end());
+    }
+
+    if (d_blocks.size() == 1)
+        compress(d_blocks[0], previous[0]);
+    else
+    {
+        vector<function<void()>> jobs;
+        for (size_t idx = 0; idx != d_blocks.size(); ++idx)
+            jobs.push_back([&, idx]() { compress(d_blocks[idx], previous[idx]); });
+        CompressionPool::instance().run(jobs);
+    }
+
+    for (Block const &block : d_blocks)
+    {
+        d_failed = d_failed or block.failed;
+        append(block.compressed.data(), block.compressed.size());
+        d_checksum = adler32_combine(d_checksum, block.checksum, block.filteredSize);
+    }
+
+    vector<uint8_t> const &rows = d_blocks.back().rows;
+    if (not rows.empty())
+        d_previous.assign(rows.end() - rowSize(), rows.end());
+    d_blocks.clear();
+}
+
+// Filters the rows of the block, the first one below previous, and deflates
+// them without a zlib header.
+void PngWriter::compress(Block &block, vector<uint8_t> const &previous) const
+{
+    size_t size = rowSize();
+    size_t rowCount = size == 0 ? 0 : block.rows.size() / size;
+
+    vector<uint8_t> filtered;
+    filtered.reserve(rowCount * (1 + size));
+    vector<uint8_t> row(1 + size);
+    vector<uint8_t> candidate(1 + size);
+    for (size_t idx = 0; idx != rowCount; ++idx)
+    {
+        uint8_t const *above = idx == 0 ? previous.data() : &block.rows[(idx - 1) * size];
+        filterRow(above, &block.rows[idx * size], size, row, candidate);
+        filtered.insert(filtered.end(), row.begin(), row.end());
+    }
+
+    block.checksum = adler32(1, filtered.data(), filtered.size());
+    block.filteredSize = filtered.size();
+
+    z_stream stream = {};
+    if (deflateInit2(&stream, d_level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        block.failed = true;
+        return;
+    }
+
+    // The bound leaves room for the sync flush marker in most cases, the
+    // output grows if it does not.
+    block.compressed.resize(deflateBound(&stream, filtered.size()) + 16);
+    stream.next_in = filtered.data();
+    stream.avail_in = filtered.size();
+    size_t used = 0;
+    while (true)
+    {
+        stream.next_out = block.compressed.data() + used;
+        stream.avail_out = block.compressed.size() - used;
+        int result = deflate(&stream, block.last ? Z_FINISH : Z_SYNC_FLUSH);
+        used = block.compressed.size() - stream.avail_out;
+
+        // Z_BUF_ERROR only means that the output is full.
+        if (result != Z_OK and result != Z_STREAM_END and result != Z_BUF_ERROR)
+        {
+            block.failed = true;
+            break;
+        }
+        if (block.last ? result == Z_STREAM_END : stream.avail_out != 0)
+            break;
+        block.compressed.resize(2 * block.compressed.size());
+    }
+    block.compressed.resize(used);
+    deflateEnd(&stream);
+}
+
+// Adds compressed data, writing an IDAT chunk whenever chunkSize bytes are
+// collected.
+void PngWriter::append(uint8_t const *data, size_t size)
+{
+    while (size != 0)
+    {
+        size_t count = min(size, chunkSize - d_chunk.size());
+        d_chunk.insert(d_chunk.end(), data, data + count);
+        data += count;
+        size -= count;
+
+        if (d_chunk.size() == chunkSize)
+        {
+            writeChunk("IDAT", d_chunk.data(), d_chunk.size());
+            d_chunk.clear();
+        }
+    }
+}
+
+// Length, type, data and the CRC of type and data.
+void PngWriter::writeChunk(char const *type, uint8_t const *data, size_t size)
+{
+    uint8_t length[4];
+    putUint32(length, size);
+    uint32_t crc = crc32(0, reinterpret_cast<Bytef const *>(type), 4);
+    if (size != 0)      // crc32 restarts for a null pointer
+        crc = crc32(crc, data, size);
+    uint8_t checksum[4];
+    putUint32(checksum, crc);
+
+    d_file.write(reinterpret_cast<char const *>(length), 4);
+    d_file.write(type, 4);
+    d_file.write(reinterpret_cast<char const *>(data), size);
+    d_file.write(reinterpret_cast<char const *>(checksum), 4);
+}
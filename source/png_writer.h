@@ -0,0 +1,83 @@
+#ifndef PNG_WRITER_H_
+#define PNG_WRITER_H_
+
+#include "triple.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Writes a PNG file (8 bit RGB) row by row, so an image does not need to be
+// converted and compressed as a whole. The file is opened and the header
+// written on construction, and the compressed data is written in chunks of
+// at most chunkSize bytes. Memory use does not depend on the image height.
+//
+// Compression runs on several threads, in the manner of pigz: the rows are
+// collected in blocks of about blockSize bytes, and every thread filters
+// and deflates a block of its own. The blocks are compressed independently
+// (without the preceding data as dictionary, costing a little compression)
+// and are joined into a single zlib stream by ending all but the last one
+// with a sync flush, which aligns them to whole bytes. The checksums of the
+// blocks are combined into the one of the stream. The file does not depend
+// on the number of threads. The threads are shared by all writers and kept
+// between files, see CompressionPool in png_writer.cpp.
+class PngWriter
+{
+    struct Block
+    {
+        std::vector<uint8_t> rows;      // unfiltered
+        std::vector<uint8_t> compressed;
+        unsigned long checksum = 1;     // Adler-32 of the filtered rows
+        size_t filteredSize = 0;
+        bool last = false;              // ends the stream
+        bool failed = false;            // zlib reported an error
+    };
+
+    std::ofstream d_file;
+    unsigned d_width;
+    unsigned d_height;
+    unsigned d_rows = 0;                // written so far
+    int d_level;
+    unsigned d_threadCount;
+    std::vector<uint8_t> d_previous;    // last row of the preceding block
+    std::vector<Block> d_blocks;        // to be compressed together
+    unsigned long d_checksum;           // of the blocks written so far
+    std::vector<uint8_t> d_chunk;       // compressed data not yet written
+    bool d_failed = false;              // compressing a block failed
+
+    public:
+        static size_t const chunkSize = 1 << 16;
+        static size_t const blockSize = 1 << 17;
+
+        // The compression level, from 0 (store, fastest) to 9 (smallest),
+        // and the number of threads compressing a file, 0 for the number of
+        // hardware threads, of the writers created afterwards.
+        static void setCompressionLevel(int level);
+        static int compressionLevel();
+        static void setThreadCount(unsigned count);
+        static unsigned threadCount();
+
+        // Compresses on threadCount threads, as set by setThreadCount.
+        PngWriter(std::string const &filename, unsigned width, unsigned height,
+                  unsigned threadCount = PngWriter::threadCount());
+
+        PngWriter(PngWriter const &) = delete;
+        PngWriter &operator=(PngWriter const &) = delete;
+
+        // Adds the next row of width pixels, with channels in [0, 1].
+        void writeRow(Color const *pixels);
+
+        // Ends the file after the last row. Returns false if the file could
+        // not be written or compressed, or not all rows were given.
+        bool finish();
+
+    private:
+        size_t rowSize() const;
+        void compressBlocks();
+        void compress(Block &block, std::vector<uint8_t> const &previous) const;
+        void append(uint8_t const *data, size_t size);
+        void writeChunk(char const *type, uint8_t const *data, size_t size);
+};
+
+#endif
@@ -0,0 +1,714 @@
+#include "primitive_arrays.h"
+
+#include "simd.h"
+#include "statistics.h"
+#include "shapes/quad.h"
+#include "shapes/sphere.h"
+
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+namespace
+{
+    double const noHit = numeric_limits<double>::infinity();
+
+    struct SphereData
+    {
+        double const *x;
+        double const *y;
+        double const *z;
+        double const *radius;
+    };
+
+    struct QuadData
+    {
+        double const *x;
+        double const *y;
+        double const *z;
+        double const *edgeUX;
+        double const *edgeUY;
+        double const *edgeUZ;
+        double const *edgeULength2;
+        double const *edgeVX;
+        double const *edgeVY;
+        double const *edgeVZ;
+        double const *edgeVLength2;
+        double const *normalX;
+        double const *normalY;
+        double const *normalZ;
+    };
+
+    typedef size_t (*SphereKernel)(SphereData const &, Ray const &, size_t, size_t, double &);
+    typedef size_t (*QuadKernel)(QuadData const &, Ray const &, size_t, size_t, double &);
+
+    // --- Scalar --------------------------------------------------------------
+
+    // Follows Sphere::intersect and Solvers::quadratic operation by operation,
+    // which the SIMD kernels do lane by lane, so that all give the same bits.
+    size_t closestSphereScalar(SphereData const &spheres, Ray const &ray,
+                               size_t begin, size_t end, double &t)
+    {
+        double a = ray.D.dot(ray.D);
+
+        size_t closest = PrimitiveArrays::npos;
+        for (size_t idx = begin; idx != end; ++idx)
+        {
+            double Lx = ray.O.x - spheres.x[idx];
+            double Ly = ray.O.y - spheres.y[idx];
+            double Lz = ray.O.z - spheres.z[idx];
+            double b = 2.0 * (ray.D.x * Lx + ray.D.y * Ly + ray.D.z * Lz);
+            double c = (Lx * Lx + Ly * Ly + Lz * Lz) - spheres.radius[idx] * spheres.radius[idx];
+
+            double discr = b * b - 4.0 * a * c;
+            if (discr < 0.0)
+                continue;
+
+            double x0;
+            double x1;
+            if (discr == 0.0)
+            {
+                x0 = x1 = -0.5 * b / a;
+            }
+            else
+            {
+                double q = b > 0.0 ? -0.5 * (b + sqrt(discr)) : -0.5 * (b - sqrt(discr));
+                x0 = q / a;
+                x1 = c / q;
+            }
+            if (x0 > x1)
+                swap(x0, x1);
+
+            // The nearest intersection in front of the ray origin.
+            double near = x0 < 0.0 ? x1 : x0;
+            if (near >= 0.0 and near < t)
+            {
+                t = near;
+                closest = idx;
+            }
+        }
+        return closest;
+    }
+
+    // Follows Quad::intersect.
+    size_t closestQuadScalar(QuadData const &quads, Ray const &ray,
+                             size_t begin, size_t end, double &t)
+    {
+        size_t closest = PrimitiveArrays::npos;
+        for (size_t idx = begin; idx != end; ++idx)
+        {
+            double Nx = quads.normalX[idx];
+            double Ny = quads.normalY[idx];
+            double Nz = quads.normalZ[idx];
+
+            // Parallel to the plane.
+            double DdotN = -ray.D.x * Nx + -ray.D.y * Ny + -ray.D.z * Nz;
+            if (abs(DdotN) < numeric_limits<double>::epsilon())
+                continue;
+
+            double Ox = ray.O.x - quads.x[idx];
+            double Oy = ray.O.y - quads.y[idx];
+            double Oz = ray.O.z - quads.z[idx];
+            double tPlane = -(Nx * Ox + Ny * Oy + Nz * Oz) / (Nx * ray.D.x + Ny * ray.D.y + Nz * ray.D.z);
+            if (tPlane < 0.0)
+                continue;
+
+            // Position of the hit relative to the first vertex.
+            double Hx = (ray.O.x + tPlane * ray.D.x) - quads.x[idx];
+            double Hy = (ray.O.y + tPlane * ray.D.y) - quads.y[idx];
+            double Hz = (ray.O.z + tPlane * ray.D.z) - quads.z[idx];
+            double u = Hx * quads.edgeUX[idx] + Hy * quads.edgeUY[idx] + Hz * quads.edgeUZ[idx];
+            double v = Hx * quads.edgeVX[idx] + Hy * quads.edgeVY[idx] + Hz * quads.edgeVZ[idx];
+            if (0.0 <= u and u <= quads.edgeULength2[idx] and 0.0 <= v and v <= quads.edgeVLength2[idx]
+                and tPlane < t)
+            {
+                t = tPlane;
+                closest = idx;
+            }
+        }
+        return closest;
+    }
+
+#ifdef SIMD_X86
+
+    // Picks the closest of the lane results, the lowest index on ties as in
+    // the scalar loop. Lanes without a hit hold a negative index.
+    size_t reduceLanes(double const *laneT, double const *laneIndex, unsigned lanes, double &t)
+    {
+        size_t closest = PrimitiveArrays::npos;
+        for (unsigned lane = 0; lane != lanes; ++lane)
+        {
+            if (laneIndex[lane] < 0.0)
+                continue;
+
+            size_t idx = static_cast<size_t>(laneIndex[lane]);
+            if (laneT[lane] < t or (laneT[lane] == t and idx < closest))
+            {
+                t = laneT[lane];
+                closest = idx;
+            }
+        }
+        return closest;
+    }
+
+    // --- AVX2, 4 lanes -------------------------------------------------------
+
+    __attribute__((target("avx2")))
+    size_t closestSphereAvx2(SphereData const &spheres, Ray const &ray,
+                             size_t begin, size_t end, double &t)
+    {
+        double a = ray.D.dot(ray.D);
+        __m256d const aLanes = _mm256_set1_pd(a);
+        __m256d const fourA = _mm256_set1_pd(4.0 * a);
+        __m256d const Ox = _mm256_set1_pd(ray.O.x);
+        __m256d const Oy = _mm256_set1_pd(ray.O.y);
+        __m256d const Oz = _mm256_set1_pd(ray.O.z);
+        __m256d const Dx = _mm256_set1_pd(ray.D.x);
+        __m256d const Dy = _mm256_set1_pd(ray.D.y);
+        __m256d const Dz = _mm256_set1_pd(ray.D.z);
+        __m256d const zero = _mm256_setzero_pd();
+        __m256d const two = _mm256_set1_pd(2.0);
+        __m256d const minusHalf = _mm256_set1_pd(-0.5);
+        __m256d const infinity = _mm256_set1_pd(noHit);
+
+        __m256d bestT = _mm256_set1_pd(t);
+        __m256d bestIndex = _mm256_set1_pd(-1.0);
+        for (size_t idx = begin; idx < end; idx += 4)
+        {
+            // The last batch may be partial.
+            __m256i loadMask = _mm256_cmpgt_epi64(_mm256_set1_epi64x(end - idx),
+                                                  _mm256_set_epi64x(3, 2, 1, 0));
+            __m256d lanes = _mm256_castsi256_pd(loadMask);
+            __m256d Lx = _mm256_sub_pd(Ox, _mm256_maskload_pd(spheres.x + idx, loadMask));
+            __m256d Ly = _mm256_sub_pd(Oy, _mm256_maskload_pd(spheres.y + idx, loadMask));
+            __m256d Lz = _mm256_sub_pd(Oz, _mm256_maskload_pd(spheres.z + idx, loadMask));
+            __m256d r = _mm256_maskload_pd(spheres.radius + idx, loadMask);
+
+            __m256d DdotL = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(Dx, Lx), _mm256_mul_pd(Dy, Ly)),
+                                          _mm256_mul_pd(Dz, Lz));
+            __m256d LdotL = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(Lx, Lx), _mm256_mul_pd(Ly, Ly)),
+                                          _mm256_mul_pd(Lz, Lz));
+            __m256d b = _mm256_mul_pd(two, DdotL);
+            __m256d c = _mm256_sub_pd(LdotL, _mm256_mul_pd(r, r));
+            __m256d discr = _mm256_sub_pd(_mm256_mul_pd(b, b), _mm256_mul_pd(fourA, c));
+
+            // Most rays miss most spheres, skip the roots then.
+            __m256d real = _mm256_and_pd(lanes, _mm256_cmp_pd(discr, zero, _CMP_GE_OQ));
+            if (_mm256_movemask_pd(real) == 0)
+                continue;
+
+            __m256d root = _mm256_sqrt_pd(discr);
+            __m256d q = _mm256_mul_pd(minusHalf,
+                                      _mm256_blendv_pd(_mm256_sub_pd(b, root), _mm256_add_pd(b, root),
+                                                       _mm256_cmp_pd(b, zero, _CMP_GT_OQ)));
+            __m256d x0 = _mm256_div_pd(q, aLanes);
+            __m256d x1 = _mm256_div_pd(c, q);
+
+            // A double root.
+            __m256d single = _mm256_cmp_pd(discr, zero, _CMP_EQ_OQ);
+            __m256d tangent = _mm256_div_pd(_mm256_mul_pd(minusHalf, b), aLanes);
+            x0 = _mm256_blendv_pd(x0, tangent, single);
+            x1 = _mm256_blendv_pd(x1, tangent, single);
+
+            __m256d swapped = _mm256_cmp_pd(x0, x1, _CMP_GT_OQ);
+            __m256d lower = _mm256_blendv_pd(x0, x1, swapped);
+            __m256d upper = _mm256_blendv_pd(x1, x0, swapped);
+            __m256d near = _mm256_blendv_pd(lower, upper, _mm256_cmp_pd(lower, zero, _CMP_LT_OQ));
+
+            __m256d hit = _mm256_and_pd(real, _mm256_cmp_pd(near, zero, _CMP_GE_OQ));
+            near = _mm256_blendv_pd(infinity, near, hit);
+
+            __m256d closer = _mm256_cmp_pd(near, bestT, _CMP_LT_OQ);
+            bestT = _mm256_blendv_pd(bestT, near, closer);
+            bestIndex = _mm256_blendv_pd(bestIndex, _mm256_set_pd(idx + 3, idx + 2, idx + 1, idx), closer);
+        }
+
+        double laneT[4];
+        double laneIndex[4];
+        _mm256_storeu_pd(laneT, bestT);
+        _mm256_storeu_pd(laneIndex, bestIndex);
+        return reduceLanes(laneT, laneIndex, 4, t);
+    }
+
+    __attribute__((target("avx2")))
+    size_t closestQuadAvx2(QuadData const &quads, Ray const &ray,
+                           size_t begin, size_t end, double &t)
+    {
+        __m256d const Ox = _mm256_set1_pd(ray.O.x);
+        __m256d const Oy = _mm256_set1_pd(ray.O.y);
+        __m256d const Oz = _mm256_set1_pd(ray.O.z);
+        __m256d const Dx = _mm256_set1_pd(ray.D.x);
+        __m256d const Dy = _mm256_set1_pd(ray.D.y);
+        __m256d const Dz = _mm256_set1_pd(ray.D.z);
+        __m256d const minusDx = _mm256_set1_pd(-ray.D.x);
+        __m256d const minusDy = _mm256_set1_pd(-ray.D.y);
+        __m256d const minusDz = _mm256_set1_pd(-ray.D.z);
+        __m256d const zero = _mm256_setzero_pd();
+        __m256d const signBit = _mm256_set1_pd(-0.0);
+        __m256d const epsilon = _mm256_set1_pd(numeric_limits<double>::epsilon());
+        __m256d const infinity = _mm256_set1_pd(noHit);
+
+        __m256d bestT = _mm256_set1_pd(t);
+        __m256d bestIndex = _mm256_set1_pd(-1.0);
+        for (size_t idx = begin; idx < end; idx += 4)
+        {
+            __m256i loadMask = _mm256_cmpgt_epi64(_mm256_set1_epi64x(end - idx),
+                                                  _mm256_set_epi64x(3, 2, 1, 0));
+            __m256d lanes = _mm256_castsi256_pd(loadMask);
+            __m256d Nx = _mm256_maskload_pd(quads.normalX + idx, loadMask);
+            __m256d Ny = _mm256_maskload_pd(quads.normalY + idx, loadMask);
+            __m256d Nz = _mm256_maskload_pd(quads.normalZ + idx, loadMask);
+            __m256d Vx = _mm256_maskload_pd(quads.x + idx, loadMask);
+            __m256d Vy = _mm256_maskload_pd(quads.y + idx, loadMask);
+            __m256d Vz = _mm256_maskload_pd(quads.z + idx, loadMask);
+
+            __m256d DdotN = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(minusDx, Nx), _mm256_mul_pd(minusDy, Ny)),
+                                          _mm256_mul_pd(minusDz, Nz));
+            __m256d facing = _mm256_cmp_pd(_mm256_andnot_pd(signBit, DdotN), epsilon, _CMP_NLT_UQ);
+
+            __m256d Lx = _mm256_sub_pd(Ox, Vx);
+            __m256d Ly = _mm256_sub_pd(Oy, Vy);
+            __m256d Lz = _mm256_sub_pd(Oz, Vz);
+            __m256d numerator = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(Nx, Lx), _mm256_mul_pd(Ny, Ly)),
+                                              _mm256_mul_pd(Nz, Lz));
+            __m256d denominator = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(Nx, Dx), _mm256_mul_pd(Ny, Dy)),
+                                                _mm256_mul_pd(Nz, Dz));
+            __m256d tPlane = _mm256_div_pd(_mm256_xor_pd(numerator, signBit), denominator);
+
+            __m256d Hx = _mm256_sub_pd(_mm256_add_pd(Ox, _mm256_mul_pd(tPlane, Dx)), Vx);
+            __m256d Hy = _mm256_sub_pd(_mm256_add_pd(Oy, _mm256_mul_pd(tPlane, Dy)), Vy);
+            __m256d Hz = _mm256_sub_pd(_mm256_add_pd(Oz, _mm256_mul_pd(tPlane, Dz)), Vz);
+            __m256d u = _mm256_add_pd(_mm256_add_pd(
+                            _mm256_mul_pd(Hx, _mm256_maskload_pd(quads.edgeUX + idx, loadMask)),
+                            _mm256_mul_pd(Hy, _mm256_maskload_pd(quads.edgeUY + idx, loadMask))),
+                            _mm256_mul_pd(Hz, _mm256_maskload_pd(quads.edgeUZ + idx, loadMask)));
+            __m256d v = _mm256_add_pd(_mm256_add_pd(
+                            _mm256_mul_pd(Hx, _mm256_maskload_pd(quads.edgeVX + idx, loadMask)),
+                            _mm256_mul_pd(Hy, _mm256_maskload_pd(quads.edgeVY + idx, loadMask))),
+                            _mm256_mul_pd(Hz, _mm256_maskload_pd(quads.edgeVZ + idx, loadMask)));
+
+            __m256d inside = _mm256_and_pd(
+                _mm256_and_pd(_mm256_cmp_pd(zero, u, _CMP_LE_OQ),
+                              _mm256_cmp_pd(u, _mm256_maskload_pd(quads.edgeULength2 + idx, loadMask), _CMP_LE_OQ)),
+                _mm256_and_pd(_mm256_cmp_pd(zero, v, _CMP_LE_OQ),
+                              _mm256_cmp_pd(v, _mm256_maskload_pd(quads.edgeVLength2 + idx, loadMask), _CMP_LE_OQ)));
+            __m256d hit = _mm256_and_pd(_mm256_and_pd(lanes, facing),
+                                        _mm256_and_pd(inside, _mm256_cmp_pd(tPlane, zero, _CMP_NLT_UQ)));
+            tPlane = _mm256_blendv_pd(infinity, tPlane, hit);
+
+            __m256d closer = _mm256_cmp_pd(tPlane, bestT, _CMP_LT_OQ);
+            bestT = _mm256_blendv_pd(bestT, tPlane, closer);
+            bestIndex = _mm256_blendv_pd(bestIndex, _mm256_set_pd(idx + 3, idx + 2, idx + 1, idx), closer);
+        }
+
+        double laneT[4];
+        double laneIndex[4];
+        _mm256_storeu_pd(laneT, bestT);
+        _mm256_storeu_pd(laneIndex, bestIndex);
+        return reduceLanes(laneT, laneIndex, 4, t);
+    }
+
+    // --- SSE4.1, 2 lanes -----------------------------------------------------
+
+    __attribute__((target("sse4.1")))
+    size_t closestSphereSse4(SphereData const &spheres, Ray const &ray,
+                             size_t begin, size_t end, double &t)
+    {
+        double a = ray.D.dot(ray.D);
+        __m128d const aLanes = _mm_set1_pd(a);
+        __m128d const fourA = _mm_set1_pd(4.0 * a);
+        __m128d const Ox = _mm_set1_pd(ray.O.x);
+        __m128d const Oy = _mm_set1_pd(ray.O.y);
+        __m128d const Oz = _mm_set1_pd(ray.O.z);
+        __m128d const Dx = _mm_set1_pd(ray.D.x);
+        __m128d const Dy = _mm_set1_pd(ray.D.y);
+        __m128d const Dz = _mm_set1_pd(ray.D.z);
+        __m128d const zero = _mm_setzero_pd();
+        __m128d const two = _mm_set1_pd(2.0);
+        __m128d const minusHalf = _mm_set1_pd(-0.5);
+        __m128d const infinity = _mm_set1_pd(noHit);
+        __m128d const firstLane = _mm_castsi128_pd(_mm_set_epi64x(0, -1));
+
+        __m128d bestT = _mm_set1_pd(t);
+        __m128d bestIndex = _mm_set1_pd(-1.0);
+        for (size_t idx = begin; idx < end; idx += 2)
+        {
+            bool pair = idx + 1 < end;
+            __m128d lanes = pair ? _mm_castsi128_pd(_mm_set1_epi64x(-1)) : firstLane;
+            __m128d Lx = _mm_sub_pd(Ox, load2(spheres.x + idx, pair));
+            __m128d Ly = _mm_sub_pd(Oy, load2(spheres.y + idx, pair));
+            __m128d Lz = _mm_sub_pd(Oz, load2(spheres.z + idx, pair));
+            __m128d r = load2(spheres.radius + idx, pair);
+
+            __m128d DdotL = _mm_add_pd(_mm_add_pd(_mm_mul_pd(Dx, Lx), _mm_mul_pd(Dy, Ly)), _mm_mul_pd(Dz, Lz));
+            __m128d LdotL = _mm_add_pd(_mm_add_pd(_mm_mul_pd(Lx, Lx), _mm_mul_pd(Ly, Ly)), _mm_mul_pd(Lz, Lz));
+            __m128d b = _mm_mul_pd(two, DdotL);
+            __m128d c = _mm_sub_pd(LdotL, _mm_mul_pd(r, r));
+            __m128d discr = _mm_sub_pd(_mm_mul_pd(b, b), _mm_mul_pd(fourA, c));
+
+            __m128d real = _mm_and_pd(lanes, _mm_cmpge_pd(discr, zero));
+            if (_mm_movemask_pd(real) == 0)
+                continue;
+
+            __m128d root = _mm_sqrt_pd(discr);
+            __m128d q = _mm_mul_pd(minusHalf, _mm_blendv_pd(_mm_sub_pd(b, root), _mm_add_pd(b, root),
+                                                            _mm_cmpgt_pd(b, zero)));
+            __m128d x0 = _mm_div_pd(q, aLanes);
+            __m128d x1 = _mm_div_pd(c, q);
+
+            __m128d single = _mm_cmpeq_pd(discr, zero);
+            __m128d tangent = _mm_div_pd(_mm_mul_pd(minusHalf, b), aLanes);
+            x0 = _mm_blendv_pd(x0, tangent, single);
+            x1 = _mm_blendv_pd(x1, tangent, single);
+
+            __m128d swapped = _mm_cmpgt_pd(x0, x1);
+            __m128d lower = _mm_blendv_pd(x0, x1, swapped);
+            __m128d upper = _mm_blendv_pd(x1, x0, swapped);
+            __m128d near = _mm_blendv_pd(lower, upper, _mm_cmplt_pd(lower, zero));
+
+            __m128d hit = _mm_and_pd(real, _mm_cmpge_pd(near, zero));
+            near = _mm_blendv_pd(infinity, near, hit);
+
+            __m128d closer = _mm_cmplt_pd(near, bestT);
+            bestT = _mm_blendv_pd(bestT, near, closer);
+            bestIndex = _mm_blendv_pd(bestIndex, _mm_set_pd(idx + 1, idx), closer);
+        }
+
+        double laneT[2];
+        double laneIndex[2];
+        _mm_storeu_pd(laneT, bestT);
+        _mm_storeu_pd(laneIndex, bestIndex);
+        return reduceLanes(laneT, laneIndex, 2, t);
+    }
+
+    __attribute__((target("sse4.1")))
+    size_t closestQuadSse4(QuadData const &quads, Ray const &ray,
+                           size_t begin, size_t end, double &t)
+    {
+        __m128d const Ox = _mm_set1_pd(ray.O.x);
+        __m128d const Oy = _mm_set1_pd(ray.O.y);
+        __m128d const Oz = _mm_set1_pd(ray.O.z);
+        __m128d const Dx = _mm_set1_pd(ray.D.x);
+        __m128d const Dy = _mm_set1_pd(ray.D.y);
+        __m128d const Dz = _mm_set1_pd(ray.D.z);
+        __m128d const minusDx = _mm_set1_pd(-ray.D.x);
+        __m128d const minusDy = _mm_set1_pd(-ray.D.y);
+        __m128d const minusDz = _mm_set1_pd(-ray.D.z);
+        __m128d const zero = _mm_setzero_pd();
+        __m128d const signBit = _mm_set1_pd(-0.0);
+        __m128d const epsilon = _mm_set1_pd(numeric_limits<double>::epsilon());
+        __m128d const infinity = _mm_set1_pd(noHit);
+        __m128d const firstLane = _mm_castsi128_pd(_mm_set_epi64x(0, -1));
+
+        __m128d bestT = _mm_set1_pd(t);
+        __m128d bestIndex = _mm_set1_pd(-1.0);
+        for (size_t idx = begin; idx < end; idx += 2)
+        {
+            bool pair = idx + 1 < end;
+            __m128d lanes = pair ? _mm_castsi128_pd(_mm_set1_epi64x(-1)) : firstLane;
+            __m128d Nx = load2(quads.normalX + idx, pair);
+            __m128d Ny = load2(quads.normalY + idx, pair);
+            __m128d Nz = load2(quads.normalZ + idx, pair);
+            __m128d Vx = load2(quads.x + idx, pair);
+            __m128d Vy = load2(quads.y + idx, pair);
+            __m128d Vz = load2(quads.z + idx, pair);
+
+            __m128d DdotN = _mm_add_pd(_mm_add_pd(_mm_mul_pd(minusDx, Nx), _mm_mul_pd(minusDy, Ny)),
+                                       _mm_mul_pd(minusDz, Nz));
+            __m128d facing = _mm_cmpnlt_pd(_mm_andnot_pd(signBit, DdotN), epsilon);
+
+            __m128d Lx = _mm_sub_pd(Ox, Vx);
+            __m128d Ly = _mm_sub_pd(Oy, Vy);
+            __m128d Lz = _mm_sub_pd(Oz, Vz);
+            __m128d numerator = _mm_add_pd(_mm_add_pd(_mm_mul_pd(Nx, Lx), _mm_mul_pd(Ny, Ly)), _mm_mul_pd(Nz, Lz));
+            __m128d denominator = _mm_add_pd(_mm_add_pd(_mm_mul_pd(Nx, Dx), _mm_mul_pd(Ny, Dy)), _mm_mul_pd(Nz, Dz));
+            __m128d tPlane = _mm_div_pd(_mm_xor_pd(numerator, signBit), denominator);
+
+            __m128d Hx = _mm_sub_pd(_mm_add_pd(Ox, _mm_mul_pd(tPlane, Dx)), Vx);
+            __m128d Hy = _mm_sub_pd(_mm_add_pd(Oy, _mm_mul_pd(tPlane, Dy)), Vy);
+            __m128d Hz = _mm_sub_pd(_mm_add_pd(Oz, _mm_mul_pd(tPlane, Dz)), Vz);
+            __m128d u = _mm_add_pd(_mm_add_pd(_mm_mul_pd(Hx, load2(quads.edgeUX + idx, pair)),
+                                              _mm_mul_pd(Hy, load2(quads.edgeUY + idx, pair))),
+                                   _mm_mul_pd(Hz, load2(quads.edgeUZ + idx, pair)));
+            __m128d v = _mm_add_pd(_mm_add_pd(_mm_mul_pd(Hx, load2(quads.edgeVX + idx, pair)),
+                                              _mm_mul_pd(Hy, load2(quads.edgeVY + idx, pair))),
+                                   _mm_mul_pd(Hz, load2(quads.edgeVZ + idx, pair)));
+
+            __m128d inside = _mm_and_pd(
+                _mm_and_pd(_mm_cmple_pd(zero, u), _mm_cmple_pd(u, load2(quads.edgeULength2 + idx, pair))),
+                _mm_and_pd(_mm_cmple_pd(zero, v), _mm_cmple_pd(v, load2(quads.edgeVLength2 + idx, pair))));
+            __m128d hit = _mm_and_pd(_mm_and_pd(lanes, facing), _mm_and_pd(inside, _mm_cmpnlt_pd(tPlane, zero)));
+            tPlane = _mm_blendv_pd(infinity, tPlane, hit);
+
+            __m128d closer = _mm_cmplt_pd(tPlane, bestT);
+            bestT = _mm_blendv_pd(bestT, tPlane, closer);
+            bestIndex = _mm_blendv_pd(bestIndex, _mm_set_pd(idx + 1, idx), closer);
+        }
+
+        double laneT[2];
+        double laneIndex[2];
+        _mm_storeu_pd(laneT, bestT);
+        _mm_storeu_pd(laneIndex, bestIndex);
+        return reduceLanes(laneT, laneIndex, 2, t);
+    }
+
+#endif
+
+    bool supported(PrimitiveArrays::Kernel kernel)
+    {
+        switch (kernel)
+        {
+#ifdef SIMD_X86
+            case PrimitiveArrays::Kernel::Avx2:
+                return __builtin_cpu_supports("avx2");
+            case PrimitiveArrays::Kernel::Sse4:
+                return __builtin_cpu_supports("sse4.1");
+#endif
+            case PrimitiveArrays::Kernel::Scalar:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    struct Kernels
+    {
+        PrimitiveArrays::Kernel kernel;
+        SphereKernel closestSphere;
+        QuadKernel closestQuad;
+
+        void select(PrimitiveArrays::Kernel selected)
+        {
+            kernel = selected;
+            switch (selected)
+            {
+#ifdef SIMD_X86
+                case PrimitiveArrays::Kernel::Avx2:
+                    closestSphere = closestSphereAvx2;
+                    closestQuad = closestQuadAvx2;
+                    break;
+                case PrimitiveArrays::Kernel::Sse4:
+                    closestSphere = closestSphereSse4;
+                    closestQuad = closestQuadSse4;
+                    break;
+#endif
+                default:
+                    closestSphere = closestSphereScalar;
+                    closestQuad = closestQuadScalar;
+                    break;
+            }
+        }
+    };
+
+    // The widest supported kernel until setKernel is called, which must not
+    // happen during a render.
+    Kernels &kernels()
+    {
+        static Kernels instance = []()
+        {
+            Kernels widest;
+            if (supported(PrimitiveArrays::Kernel::Avx2))
+                widest.select(PrimitiveArrays::Kernel::Avx2);
+            else if (supported(PrimitiveArrays::Kernel::Sse4))
+                widest.select(PrimitiveArrays::Kernel::Sse4);
+            else
+                widest.select(PrimitiveArrays::Kernel::Scalar);
+            return widest;
+        }();
+        return instance;
+    }
+}
+
+bool PrimitiveArrays::accepts(Object const &obj)
+{
+    return isSphere(obj) or isQuad(obj);
+}
+
+bool PrimitiveArrays::isSphere(Object const &obj)
+{
+    return dynamic_cast<Sphere const *>(&obj) != nullptr;
+}
+
+bool PrimitiveArrays::isQuad(Object const &obj)
+{
+    return dynamic_cast<Quad const *>(&obj) != nullptr;
+}
+
+void PrimitiveArrays::add(ObjectPtr const &obj)
+{
+    if (auto const *sphere = dynamic_cast<Sphere const *>(obj.get()))
+    {
+        d_sphereX.push_back(sphere->position.x);
+        d_sphereY.push_back(sphere->position.y);
+        d_sphereZ.push_back(sphere->position.z);
+        d_sphereRadius.push_back(sphere->r);
+        d_sphereObjects.push_back(obj);
+    }
+    else if (auto const *quad = dynamic_cast<Quad const *>(obj.get()))
+    {
+        Vector edgeU = quad->v1 - quad->v0;
+        Vector edgeV = quad->v3 - quad->v0;
+        d_quadX.push_back(quad->v0.x);
+        d_quadY.push_back(quad->v0.y);
+        d_quadZ.push_back(quad->v0.z);
+        d_edgeUX.push_back(edgeU.x);
+        d_edgeUY.push_back(edgeU.y);
+        d_edgeUZ.push_back(edgeU.z);
+        d_edgeULength2.push_back(edgeU.length_2());
+        d_edgeVX.push_back(edgeV.x);
+        d_edgeVY.push_back(edgeV.y);
+        d_edgeVZ.push_back(edgeV.z);
+        d_edgeVLength2.push_back(edgeV.length_2());
+        d_normalX.push_back(quad->N.x);
+        d_normalY.push_back(quad->N.y);
+        d_normalZ.push_back(quad->N.z);
+        d_quadObjects.push_back(obj);
+    }
+}
+
+void PrimitiveArrays::clear()
+{
+    *this = PrimitiveArrays();
+}
+
+size_t PrimitiveArrays::size() const
+{
+    return d_sphereObjects.size() + d_quadObjects.size();
+}
+
+size_t PrimitiveArrays::sphereCount() const
+{
+    return d_sphereObjects.size();
+}
+
+size_t PrimitiveArrays::quadCount() const
+{
+    return d_quadObjects.size();
+}
+
+ObjectPtr PrimitiveArrays::intersect(Ray const &ray, Hit &minHit) const
+{
+    ObjectPtr obj = nullptr;
+
+    double t = minHit.t;
+    size_t sphereIndex = closestSphere(ray, 0, d_sphereObjects.size(), t);
+    size_t quadIndex = closestQuad(ray, 0, d_quadObjects.size(), t);
+
+    // Only the closest primitive gets its normal.
+    if (quadIndex != npos)
+    {
+        minHit = quadHit(quadIndex, t);
+        obj = d_quadObjects[quadIndex];
+    }
+    else if (sphereIndex != npos)
+    {
+        minHit = sphereHit(sphereIndex, ray, t);
+        obj = d_sphereObjects[sphereIndex];
+    }
+    return obj;
+}
+
+bool PrimitiveArrays::occluded(Ray const &ray, double maxT) const
+{
+    // The nearest intersection in front of the ray origin decides, as in
+    // Sphere::occludes and Quad::occludes.
+    double t = maxT;
+    return closestSphere(ray, 0, d_sphereObjects.size(), t) != npos
+        or closestQuad(ray, 0, d_quadObjects.size(), t) != npos;
+}
+
+size_t PrimitiveArrays::closestSphere(Ray const &ray, size_t begin, size_t end, double &t) const
+{
+    if (Statistics::enabled)
+    {
+        for (size_t idx = begin; idx != end; ++idx)
+            Statistics::local().countIntersectionTest(*d_sphereObjects[idx]);
+    }
+
+    if (begin == end)
+        return npos;
+
+    SphereData spheres{d_sphereX.data(), d_sphereY.data(), d_sphereZ.data(), d_sphereRadius.data()};
+    return kernels().closestSphere(spheres, ray, begin, end, t);
+}
+
+size_t PrimitiveArrays::closestQuad(Ray const &ray, size_t begin, size_t end, double &t) const
+{
+    if (Statistics::enabled)
+    {
+        for (size_t idx = begin; idx != end; ++idx)
+            Statistics::local().countIntersectionTest(*d_quadObjects[idx]);
+    }
+
+    if (begin == end)
+        return npos;
+
+    QuadData quads{d_quadX.data(), d_quadY.data(), d_quadZ.data(),
+                   d_edgeUX.data(), d_edgeUY.data(), d_edgeUZ.data(), d_edgeULength2.data(),
+                   d_edgeVX.data(), d_edgeVY.data(), d_edgeVZ.data(), d_edgeVLength2.data(),
+                   d_normalX.data(), d_normalY.data(), d_normalZ.data()};
+    return kernels().closestQuad(quads, ray, begin, end, t);
+}
+
+Hit PrimitiveArrays::sphereHit(size_t idx, Ray const &ray, double t) const
+{
+    Point center(d_sphereX[idx], d_sphereY[idx], d_sphereZ[idx]);
+    return Hit(t, (ray.at(t) - center).normalized());
+}
+
+Hit PrimitiveArrays::quadHit(size_t idx, double t) const
+{
+    return Hit(t, Vector(d_normalX[idx], d_normalY[idx], d_normalZ[idx]));
+}
+
+ObjectPtr const &PrimitiveArrays::sphere(size_t idx) const
+{
+    return d_sphereObjects[idx];
+}
+
+ObjectPtr const &PrimitiveArrays::quad(size_t idx) const
+{
+    return d_quadObjects[idx];
+}
+
+PrimitiveArrays::Kernel PrimitiveArrays::kernel()
+{
+    return kernels().kernel;
+}
+
+bool PrimitiveArrays::setKernel(Kernel kernel)
+{
+    if (not supported(kernel))
+        return false;
+
+    kernels().select(kernel);
+    return true;
+}
+
+bool PrimitiveArrays::parseKernel(string const &name, Kernel &kernel)
+{
+    if (name == "scalar")
+        kernel = Kernel::Scalar;
+    else if (name == "sse4")
+        kernel = Kernel::Sse4;
+    else if (name == "avx2")
+        kernel = Kernel::Avx2;
+    else
+        return false;
+    return true;
+}
+
+string PrimitiveArrays::kernelName(Kernel kernel)
+{
+    switch (kernel)
+    {
+        case Kernel::Avx2:
+            return "avx2";
+        case Kernel::Sse4:
+            return "sse4";
+        case Kernel::Scalar:
+        default:
+            return "scalar";
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef PRIMITIVE_ARRAYS_H_
+#define PRIMITIVE_ARRAYS_H_
+
+#include "hit.h"
+#include "object.h"
+#include "ray.h"
+
+#include <string>
+#include <vector>
+
+// Spheres and quads packed into structure of arrays form, so that a ray
+// tests them with SIMD kernels over contiguous coordinates instead of through
+// a virtual call per heap allocated object. The results equal those of
+// Sphere::intersect and Quad::intersect. The objects themselves are kept
+// alongside for shading, they hold the materials.
+class PrimitiveArrays
+{
+    // Spheres: centers and radii.
+    std::vector<double> d_sphereX;
+    std::vector<double> d_sphereY;
+    std::vector<double> d_sphereZ;
+    std::vector<double> d_sphereRadius;
+    std::vector<ObjectPtr> d_sphereObjects;
+
+    // Quads: the first vertex, the edges to the second and the fourth
+    // vertex with their squared lengths, and the normal.
+    std::vector<double> d_quadX;
+    std::vector<double> d_quadY;
+    std::vector<double> d_quadZ;
+    std::vector<double> d_edgeUX;
+    std::vector<double> d_edgeUY;
+    std::vector<double> d_edgeUZ;
+    std::vector<double> d_edgeULength2;
+    std::vector<double> d_edgeVX;
+    std::vector<double> d_edgeVY;
+    std::vector<double> d_edgeVZ;
+    std::vector<double> d_edgeVLength2;
+    std::vector<double> d_normalX;
+    std::vector<double> d_normalY;
+    std::vector<double> d_normalZ;
+    std::vector<ObjectPtr> d_quadObjects;
+
+    public:
+        // Implementations of the intersection tests. The kernels test one
+        // ray against 4 (AVX2) or 2 (SSE4.1) primitives at once, in double
+        // precision like the rest of the ray tracer.
+        enum class Kernel
+        {
+            Scalar,
+            Sse4,
+            Avx2
+        };
+
+        static size_t const npos = static_cast<size_t>(-1);
+
+        // Whether the object is a sphere or a quad.
+        static bool accepts(Object const &obj);
+        static bool isSphere(Object const &obj);
+        static bool isQuad(Object const &obj);
+
+        void add(ObjectPtr const &obj);     // obj must be accepted
+        void clear();
+        size_t size() const;
+        size_t sphereCount() const;
+        size_t quadCount() const;
+
+        // Closest primitive hit before minHit.t, which is updated on a hit.
+        // Returns nullptr if no such primitive exists.
+        ObjectPtr intersect(Ray const &ray, Hit &minHit) const;
+
+        // Whether any primitive is hit before maxT.
+        bool occluded(Ray const &ray, double maxT) const;
+
+        // Closest sphere or quad among [begin, end) hit before t, which is
+        // updated on a hit. Returns its index, or npos if none is hit.
+        size_t closestSphere(Ray const &ray, size_t begin, size_t end, double &t) const;
+        size_t closestQuad(Ray const &ray, size_t begin, size_t end, double &t) const;
+
+        // The hit with its normal, for a distance returned above.
+        Hit sphereHit(size_t idx, Ray const &ray, double t) const;
+        Hit quadHit(size_t idx, double t) const;
+
+        ObjectPtr const &sphere(size_t idx) const;
+        ObjectPtr const &quad(size_t idx) const;
+
+        // The kernel in use, by default the widest one the CPU supports.
+        static Kernel kernel();
+
+        // Returns false, and keeps the current kernel, if the CPU does not
+        // support the given one.
+        static bool setKernel(Kernel kernel);
+
+        static bool parseKernel(std::string const &name, Kernel &kernel);
+        static std::string kernelName(Kernel kernel);
+};
+
+#endif
@@ -9,16 +9,36 @@ class Ray
         Point O;        // origin
         Vector D;       // direction of the ray
 
+        // Distance along the ray up to which ray marched objects are known
+        // to be empty, so marching can start there. See Scene::coneMarch.
+        double marchStart;
+
+        // The ray as a cone, for filtering textures: its width at the origin
+        // and the growth of the width per unit of distance. Primary rays
+        // cover a pixel (sample), see Scene::primaryRay, other rays continue
+        // the cone of the ray they are spawned from. Zero for a thin ray.
+        double width;
+        double spread;
+
         Ray(Point const &from, Vector const &dir)
         :
             O(from),
-            D(dir)
+            D(dir),
+            marchStart(0.0),
+            width(0.0),
+            spread(0.0)
         {}
 
         Point at(double t) const
         {
             return O + t * D;
         }
+
+        // Width of the cone at distance t.
+        double widthAt(double t) const
+        {
+            return width + t * spread;
+        }
 };
 
 #endif
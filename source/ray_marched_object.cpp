@@ -1,32 +1,438 @@
 #include "ray_marched_object.h"
 
+#include "primitive_arrays.h"
+#include "shapes/solvers.h"
+#include "statistics.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
 using namespace std;
 
+namespace
+{
+    // Positions transformed per call of batchDistanceEstimator.
+    size_t const batchSize = 16;
+
+    // Relative difference allowed between fused and separate operations,
+    // the matrices are rounded differently than the steps one by one.
+    double const fusionTolerance = 1e-9;
+}
+
+void RayMarchedObject::initialize()
+{
+    bounded = boundingSphere(boundsCenter, boundsRadius);
+
+    // The bounds are mapped from object space, so in reverse order.
+    for (auto operation = operations.rbegin(); bounded and operation != operations.rend(); ++operation)
+        bounded = (*operation)->tranformBounds(boundsCenter, boundsRadius);
+
+    // Hits are counted slightly outside of the surface.
+    boundsRadius += distanceThreshold;
+
+    fuseOperations();
+}
+
+// Folds the operations into preRepeat, repeat, postRepeat and distanceScale,
+// so that a distance evaluation does not call every operation. Chains with
+// more than one repeat are left as they are.
+void RayMarchedObject::fuseOperations()
+{
+    fused = true;
+    preRepeat = AffineTransform();
+    repeated = false;
+    postRepeat = AffineTransform();
+    distanceScale = 1.0;
+
+    for (auto *operation : operations)
+    {
+        operation->tranformDistance(distanceScale);
+
+        if (operation->tranformAffine(repeated ? postRepeat : preRepeat))
+            continue;
+
+        auto *repeatOperation = dynamic_cast<Repeat*>(operation);
+        if (repeatOperation and not repeated)
+        {
+            repeat = *repeatOperation;
+            repeated = true;
+            continue;
+        }
+
+        fused = false;
+        return;
+    }
+
+    assert(fusionMatches());
+}
+
+// Whether the fused stages map some positions as the operations one by one,
+// within fusionTolerance. The stages are compared separately around the
+// repeat, which may map nearly equal positions into different cells.
+bool RayMarchedObject::fusionMatches()
+{
+    auto close = [](Point const &fusedPosition, Point const &position)
+    {
+        return (fusedPosition - position).length() <= fusionTolerance * (1.0 + position.length());
+    };
+
+    Point const samples[] = {Point(0.0, 0.0, 0.0), Point(0.3, -0.7, 1.1), Point(-2.5, 0.5, 4.0),
+                             Point(10.0, -7.0, 3.0)};
+    for (Point const &sample : samples)
+    {
+        Point position = sample;
+        auto operation = operations.begin();
+        for (; operation != operations.end() and not dynamic_cast<Repeat*>(*operation); ++operation)
+            (*operation)->tranformPosition(position);
+
+        Point fusedPosition = sample;
+        preRepeat.tranformPosition(fusedPosition);
+        if (not close(fusedPosition, position))
+            return false;
+
+        if (not repeated)
+            continue;
+
+        (*operation)->tranformPosition(position);
+        fusedPosition = position;
+        for (++operation; operation != operations.end(); ++operation)
+            (*operation)->tranformPosition(position);
+
+        postRepeat.tranformPosition(fusedPosition);
+        if (not close(fusedPosition, position))
+            return false;
+    }
+    return true;
+}
+
 Hit RayMarchedObject::intersect(Ray const &ray)
 {
-    double totalDistance = 0.0;
-    for (size_t steps = 0; steps < maxSteps; ++steps)
+    double t = march(ray, maxDistance);
+    if (t == numeric_limits<double>::infinity())
+        return Hit::NO_HIT();
+
+    // Take a step back when calculating the normal. The normal itself is
+    // only calculated if this turns out to be the closest hit, see normal().
+    return Hit::deferred(t, ray.at(t) - distanceThreshold * ray.D);
+}
+
+Vector RayMarchedObject::normal(Hit const &hit)
+{
+    if (hit.hasNormal)
+        return hit.N;
+
+    return calculateNormal(hit.position);
+}
+
+RayPacket::Mask RayMarchedObject::intersectPacket(RayPacket const &packet, RayPacket::Mask mask,
+                                                  Hit *minHits)
+{
+    // The lanes that miss the bounding sphere are done, as in march.
+    double tMin[RayPacket::maxSize];
+    double maxT[RayPacket::maxSize];
+    RayPacket::Mask marching = 0;
+    for (unsigned lane = 0; lane != packet.size; ++lane)
+    {
+        if (not (mask >> lane & 1))
+            continue;
+
+        Ray const &ray = *packet.rays[lane];
+        tMin[lane] = ray.marchStart;
+        maxT[lane] = maxDistance;
+        if (bounded and not clip(ray, tMin[lane], maxT[lane]))
+            continue;
+        if (tMin[lane] <= maxT[lane])
+            marching |= RayPacket::Mask(1) << lane;
+    }
+
+    double t[RayPacket::maxSize];
+    size_t steps[RayPacket::maxSize];
+    MarchExit exits[RayPacket::maxSize];
+    march(packet, marching, tMin, maxT, t, steps, exits);
+
+    RayPacket::Mask closer = 0;
+    for (unsigned lane = 0; lane != packet.size; ++lane)
+    {
+        if (not (marching >> lane & 1))
+            continue;
+
+        Ray const &ray = *packet.rays[lane];
+        recordMarch(ray, tMin[lane], maxT[lane], exits[lane], steps[lane]);
+        if (t[lane] < minHits[lane].t)
+        {
+            minHits[lane] = Hit::deferred(t[lane], ray.at(t[lane]) - distanceThreshold * ray.D);
+            closer |= RayPacket::Mask(1) << lane;
+        }
+    }
+    return closer;
+}
+
+bool RayMarchedObject::occludes(Ray const &ray, double maxT)
+{
+    return march(ray, min(maxT, maxDistance)) < maxT;
+}
+
+BoundingBox RayMarchedObject::bounds()
+{
+    if (not bounded)
+        return BoundingBox::UNBOUNDED();
+
+    return BoundingBox(boundsCenter - boundsRadius, boundsCenter + boundsRadius);
+}
+
+bool RayMarchedObject::boundingSphere(Point &center, double &radius)
+{
+    return false;
+}
+
+// Narrows [tMin, tMax] down to the part of the ray inside the bounding
+// sphere. Returns false if nothing is left.
+bool RayMarchedObject::clip(Ray const &ray, double &tMin, double &tMax) const
+{
+    Vector L = ray.O - boundsCenter;
+    double a = ray.D.dot(ray.D);
+    double b = 2.0 * ray.D.dot(L);
+    double c = L.dot(L) - boundsRadius * boundsRadius;
+
+    double t0;
+    double t1;
+    if (not Solvers::quadratic(a, b, c, t0, t1))
+        return false;
+
+    tMin = max(tMin, t0);
+    tMax = min(tMax, t1);
+    return tMin <= tMax;
+}
+
+// Returns the distance along the ray to the first hit, or infinity if there
+// is no hit before maxT.
+double RayMarchedObject::march(Ray const &ray, double maxT)
+{
+    // Rays missing the bounding sphere cost a single analytic test.
+    double tMin = ray.marchStart;
+    if (bounded and not clip(ray, tMin, maxT))
+        return numeric_limits<double>::infinity();
+
+    if (tMin > maxT)
+        return numeric_limits<double>::infinity();
+
+    size_t steps;
+    MarchExit exit;
+    double t = march(ray, tMin, maxT, overRelaxation, steps, exit);
+    recordMarch(ray, tMin, maxT, exit, steps);
+    return t;
+}
+
+// Counts the steps of a march over [tMin, maxT] that ended by exit, and
+// samples the savings of over-relaxation.
+void RayMarchedObject::recordMarch(Ray const &ray, double tMin, double maxT, MarchExit exit,
+                                   size_t steps)
+{
+    if (Statistics::enabled)
+    {
+        Statistics &statistics = Statistics::local();
+        statistics.marchSteps += steps;
+        if (exit == MarchExit::OutOfSteps)
+            ++statistics.maxStepsExits;
+    }
+
+    // Every so often also run the plain march, to measure the steps saved.
+    // The counter is per thread so the common case does not contend.
+    thread_local size_t marchCount = 0;
+    if (overRelaxation > 1.0 and marchCount++ % relaxationSampleInterval == 0)
+    {
+        size_t plainSteps;
+        MarchExit plainExit;
+        march(ray, tMin, maxT, 1.0, plainSteps, plainExit);
+        ++relaxationSampleCount;
+        relaxedSampleSteps += steps;
+        plainSampleSteps += plainSteps;
+    }
+}
+
+// Enhanced sphere tracing as described by Keinert et al. (2014):
+// https://erleuchtet.org/~cupe/permanent/enhanced_sphere_tracing.pdf
+// Steps are omega times the distance estimate. If the unbounding spheres of
+// two consecutive positions do not overlap, the relaxed step may have
+// skipped a surface, so we step back and continue with plain steps.
+double RayMarchedObject::march(Ray const &ray, double tMin, double maxT, double omega, size_t &steps,
+                               MarchExit &exit)
+{
+    double totalDistance = tMin;
+    double previousDistance = 0.0;
+    double stepLength = 0.0;
+    for (steps = 0; steps < maxSteps; ++steps)
     {
         // March the ray forward.
         Point hit = ray.at(totalDistance);
         double distance = calculateDistance(hit);
 
+        if (omega > 1.0 and abs(distance) + previousDistance < stepLength)
+        {
+            // Return to the previous position and take a plain step instead.
+            totalDistance += previousDistance - stepLength;
+            stepLength = previousDistance;
+            omega = 1.0;
+            continue;
+        }
+
         // If we are close enough, we count a hit.
         if (distance < distanceThreshold)
         {
-            // Take a step back when calculating the normal.
-            Vector normal = calculateNormal(hit - distanceThreshold * ray.D);
-            return Hit(totalDistance, normal);
+            ++steps;
+            exit = MarchExit::Hit;
+            return totalDistance;
         }
 
-        totalDistance += distance;
+        previousDistance = distance;
+        stepLength = omega * distance;
+        totalDistance += stepLength;
 
         // If we are too far away, we break and return no hit.
+        if (totalDistance > maxT)
+        {
+            ++steps;
+            exit = MarchExit::BeyondMaxT;
+            return numeric_limits<double>::infinity();
+        }
+    }
+
+    exit = MarchExit::OutOfSteps;
+    return numeric_limits<double>::infinity();
+}
+
+// The march above over the lanes of the packet in mask, each with its own
+// tMin and maxT. Every iteration takes one step on all lanes that are still
+// marching: their positions are gathered first and their distances are
+// evaluated together. Lanes finish independently, with the same distance
+// and step count (and exit) as the march of their ray alone.
+void RayMarchedObject::march(RayPacket const &packet, RayPacket::Mask mask, double const *tMin,
+                             double const *maxT, double *t, size_t *steps, MarchExit *exits)
+{
+    double totalDistance[RayPacket::maxSize];
+    double previousDistance[RayPacket::maxSize];
+    double stepLength[RayPacket::maxSize];
+    double omega[RayPacket::maxSize];
+    for (unsigned lane = 0; lane != packet.size; ++lane)
+    {
+        totalDistance[lane] = tMin[lane];
+        previousDistance[lane] = 0.0;
+        stepLength[lane] = 0.0;
+        omega[lane] = overRelaxation;
+        t[lane] = numeric_limits<double>::infinity();
+        steps[lane] = 0;
+        exits[lane] = MarchExit::OutOfSteps;
+    }
+
+    RayPacket::Mask marching = maxSteps == 0 ? 0 : mask;
+    while (marching != 0)
+    {
+        // Gather the positions of the marching lanes.
+        unsigned lanes[RayPacket::maxSize];
+        double x[RayPacket::maxSize];
+        double y[RayPacket::maxSize];
+        double z[RayPacket::maxSize];
+        unsigned count = 0;
+        for (unsigned lane = 0; lane != packet.size; ++lane)
+        {
+            if (not (marching >> lane & 1))
+                continue;
+
+            Point position = packet.rays[lane]->at(totalDistance[lane]);
+            lanes[count] = lane;
+            x[count] = position.x;
+            y[count] = position.y;
+            z[count] = position.z;
+            ++count;
+        }
+
+        double distances[RayPacket::maxSize];
+        calculateDistances(count, x, y, z, distances);
+
+        for (unsigned idx = 0; idx != count; ++idx)
+        {
+            unsigned lane = lanes[idx];
+            double distance = distances[idx];
+            RayPacket::Mask bit = RayPacket::Mask(1) << lane;
+
+            if (omega[lane] > 1.0 and abs(distance) + previousDistance[lane] < stepLength[lane])
+            {
+                // Return to the previous position and take a plain step instead.
+                totalDistance[lane] += previousDistance[lane] - stepLength[lane];
+                stepLength[lane] = previousDistance[lane];
+                omega[lane] = 1.0;
+            }
+            else if (distance < distanceThreshold)
+            {
+                t[lane] = totalDistance[lane];
+                exits[lane] = MarchExit::Hit;
+                marching &= ~bit;
+            }
+            else
+            {
+                previousDistance[lane] = distance;
+                stepLength[lane] = omega[lane] * distance;
+                totalDistance[lane] += stepLength[lane];
+                if (totalDistance[lane] > maxT[lane])
+                {
+                    exits[lane] = MarchExit::BeyondMaxT;
+                    marching &= ~bit;
+                }
+            }
+
+            if (++steps[lane] == maxSteps)
+                marching &= ~bit;
+        }
+    }
+}
+
+// Cone marching as described by Keinert et al. (2014). A ball of radius d
+// around a point at distance t along the axis contains the cone up to
+// distance t + (d - t * tan) / (1 + tan), where tan is the tangent of the
+// half angle. The margin of distanceThreshold keeps the rays inside the cone
+// from counting a hit before the returned distance.
+double RayMarchedObject::coneMarch(Ray const &axis, double tanHalfAngle)
+{
+    double totalDistance = axis.marchStart;
+    size_t steps = 0;
+    while (steps < maxSteps)
+    {
+        ++steps;
+        Point position = axis.at(totalDistance);
+        double coneRadius = totalDistance * tanHalfAngle + distanceThreshold;
+
+        // Far away, the distance to the bounding sphere is a cheaper lower bound.
+        double distance = bounded ? (position - boundsCenter).length() - boundsRadius : 0.0;
+        if (distance - coneRadius < distanceThreshold)
+            distance = max(distance, calculateDistance(position));
+
+        double clearance = distance - coneRadius;
+        if (clearance < distanceThreshold)
+            break;
+
+        totalDistance += clearance / (1.0 + tanHalfAngle);
         if (totalDistance > maxDistance)
             break;
     }
 
-    return Hit::NO_HIT();
+    if (Statistics::enabled)
+        Statistics::local().coneMarchSteps += steps;
+    return totalDistance;
+}
+
+double RayMarchedObject::relaxationSavings() const
+{
+    if (plainSampleSteps == 0)
+        return 0.0;
+
+    return 1.0 - static_cast<double>(relaxedSampleSteps) / plainSampleSteps;
+}
+
+size_t RayMarchedObject::relaxationSamples() const
+{
+    return relaxationSampleCount;
 }
 
 double RayMarchedObject::calculateDistance(Point const &position)
@@ -43,17 +449,116 @@ double RayMarchedObject::calculateDistance(Point const &position)
     return distance;
 }
 
+// calculateDistance for count positions given by their coordinates.
+void RayMarchedObject::calculateDistances(size_t count, double const *x, double const *y,
+                                          double const *z, double *distances)
+{
+    for (size_t begin = 0; begin < count; begin += batchSize)
+    {
+        size_t size = min(batchSize, count - begin);
+
+        // Apply operations to the input positions.
+        double transformedX[batchSize];
+        double transformedY[batchSize];
+        double transformedZ[batchSize];
+        for (size_t idx = 0; idx != size; ++idx)
+        {
+            Point transformed(x[begin + idx], y[begin + idx], z[begin + idx]);
+            transformPosition(transformed);
+            transformedX[idx] = transformed.x;
+            transformedY[idx] = transformed.y;
+            transformedZ[idx] = transformed.z;
+        }
+
+        batchDistanceEstimator(size, transformedX, transformedY, transformedZ, distances + begin);
+
+        // Apply operations to the output distance estimates.
+        for (size_t idx = 0; idx != size; ++idx)
+            transformDistance(distances[begin + idx]);
+    }
+}
+
+void RayMarchedObject::calculateDistances(Point const *positions, size_t count, double *distances)
+{
+    double x[batchSize];
+    double y[batchSize];
+    double z[batchSize];
+    for (size_t begin = 0; begin < count; begin += batchSize)
+    {
+        size_t size = min(batchSize, count - begin);
+        for (size_t idx = 0; idx != size; ++idx)
+        {
+            x[idx] = positions[begin + idx].x;
+            y[idx] = positions[begin + idx].y;
+            z[idx] = positions[begin + idx].z;
+        }
+        calculateDistances(size, x, y, z, distances + begin);
+    }
+}
+
+void RayMarchedObject::batchDistanceEstimator(size_t count, double const *x, double const *y,
+                                              double const *z, double *distances)
+{
+    for (size_t idx = 0; idx != count; ++idx)
+        distances[idx] = distanceEstimator(Point(x[idx], y[idx], z[idx]));
+}
+
+bool RayMarchedObject::useAvx2()
+{
+    return PrimitiveArrays::kernel() == PrimitiveArrays::Kernel::Avx2;
+}
+
+bool RayMarchedObject::gradient(Point const &position, Vector &gradient)
+{
+    return false;
+}
+
 Vector RayMarchedObject::calculateNormal(Point const &hit)
+{
+    switch (normalMode)
+    {
+        case NormalMode::CentralDifferences:
+            return centralDifferencesNormal(hit);
+
+        case NormalMode::Analytic:
+        {
+            Point transformed(hit);
+            transformPosition(transformed);
+
+            Vector normal;
+            if (gradient(transformed, normal))
+            {
+                // Bring the gradient back from object space.
+                transformGradient(normal);
+                normal.normalize();
+                return normal;
+            }
+            return tetrahedralNormal(hit);
+        }
+
+        case NormalMode::Tetrahedral:
+        default:
+            return tetrahedralNormal(hit);
+    }
+}
+
+Vector RayMarchedObject::centralDifferencesNormal(Point const &hit)
 {
     // Small offsets along the coordinate axes.
     Point xOffset(distanceThreshold, 0.0, 0.0);
     Point yOffset(0.0, distanceThreshold, 0.0);
     Point zOffset(0.0, 0.0, distanceThreshold);
 
-    // Calculate the gradient of the distance estimator along these offsets.
-    double xGradient = calculateDistance(hit + xOffset) - calculateDistance(hit - xOffset);
-    double yGradient = calculateDistance(hit + yOffset) - calculateDistance(hit - yOffset);
-    double zGradient = calculateDistance(hit + zOffset) - calculateDistance(hit - zOffset);
+    // Calculate the gradient of the distance estimator along these offsets,
+    // with the six samples evaluated together.
+    Point samples[6] = {hit + xOffset, hit - xOffset, hit + yOffset, hit - yOffset,
+                        hit + zOffset, hit - zOffset};
+    double distances[6];
+    calculateDistances(samples, 6, distances);
+
+    double xGradient = distances[0] - distances[1];
+    double yGradient = distances[2] - distances[3];
+    double zGradient = distances[4] - distances[5];
 
     // Approximate the normal by the gradients.
     Vector normal(xGradient, yGradient, zGradient);
@@ -61,14 +566,74 @@ Vector RayMarchedObject::calculateNormal(Point const &hit)
     return normal;
 }
 
+// Tetrahedral technique adapted from:
+// https://www.iquilezles.org/www/articles/normalsSDF/normalsSDF.htm
+Vector RayMarchedObject::tetrahedralNormal(Point const &hit)
+{
+    // Corners of a tetrahedron, the sum of the samples weighted by their
+    // corner is proportional to the gradient.
+    Vector corner1( 1.0, -1.0, -1.0);
+    Vector corner2(-1.0, -1.0,  1.0);
+    Vector corner3(-1.0,  1.0, -1.0);
+    Vector corner4( 1.0,  1.0,  1.0);
+
+    // Sample at the same distance from the hit as the central differences.
+    double offset = 0.57735027 * distanceThreshold;
+
+    Point samples[4] = {hit + offset * corner1, hit + offset * corner2,
+                        hit + offset * corner3, hit + offset * corner4};
+    double distances[4];
+    calculateDistances(samples, 4, distances);
+
+    Vector normal = corner1 * distances[0]
+                  + corner2 * distances[1]
+                  + corner3 * distances[2]
+                  + corner4 * distances[3];
+    normal.normalize();
+    return normal;
+}
+
 void RayMarchedObject::transformPosition(Point &position)
 {
+    if (fused)
+    {
+        // Calls on the members themselves are not dispatched virtually.
+        preRepeat.tranformPosition(position);
+        if (repeated)
+        {
+            repeat.tranformPosition(position);
+            postRepeat.tranformPosition(position);
+        }
+        return;
+    }
+
     for (auto *operation : operations)
         operation->tranformPosition(position);
 }
 
 void RayMarchedObject::transformDistance(double &distance)
 {
+    if (fused)
+    {
+        distance *= distanceScale;
+        return;
+    }
+
     for (auto *operation : operations)
         operation->tranformDistance(distance);
 }
+
+void RayMarchedObject::transformGradient(Vector &gradient)
+{
+    // The inverse of the position transformation, so in reverse order.
+    if (fused)
+    {
+        if (repeated)
+            postRepeat.tranformGradient(gradient);
+        preRepeat.tranformGradient(gradient);
+        return;
+    }
+
+    for (auto operation = operations.rbegin(); operation != operations.rend(); ++operation)
+        (*operation)->tranformGradient(gradient);
+}
@@ -2,27 +2,122 @@
 #define RAY_MARCHED_OBJECT_H_
 
 #include "object.h"
+#include "operations/affine_transform.h"
 #include "operations/operation.h"
+#include "operations/repeat.h"
 
+#include <atomic>
 #include <vector>
 
 class RayMarchedObject : public Object
 {
 public:
+    // How the normal at a hit is estimated from the distance estimator.
+    enum class NormalMode
+    {
+        CentralDifferences, // six distance samples along the coordinate axes
+        Tetrahedral,        // four distance samples at the corners of a tetrahedron
+        Analytic            // gradient(), falls back to Tetrahedral if not provided
+    };
+
     size_t maxSteps = 128;
     double distanceThreshold = 1E-3;
     double maxDistance = 1E3;
+    NormalMode normalMode = NormalMode::Tetrahedral;
+    double overRelaxation = 1.0;    // step length factor omega, 1 disables it
     std::vector<Operation*> operations;
 
+    // Precomputes data that depends on the operations, such as the bounds
+    // and the fused transformation.
+    // Must be called again after changing the operations.
+    void initialize();
+
     Hit intersect(Ray const &ray) override;
+    RayPacket::Mask intersectPacket(RayPacket const &packet, RayPacket::Mask mask,
+                                    Hit *minHits) override;
+    Vector normal(Hit const &hit) override;
+    bool occludes(Ray const &ray, double maxT) override;
+    BoundingBox bounds() override;
+
+    // Distance along the axis before which no part of the cone around it
+    // comes within distanceThreshold of the shape. Marching starts at the
+    // axis' marchStart, which must itself be such a distance.
+    double coneMarch(Ray const &axis, double tanHalfAngle);
+
     virtual double distanceEstimator(Point const &position) = 0;
 
+    // distanceEstimator for count positions given by their coordinates, so
+    // that shapes can evaluate several positions at once with SIMD
+    // instructions. The default loops over distanceEstimator.
+    virtual void batchDistanceEstimator(size_t count, double const *x, double const *y,
+                                        double const *z, double *distances);
+
+    // Shapes that lie within a known sphere (before applying the operations)
+    // override this and return true. Rays are then only marched inside it.
+    virtual bool boundingSphere(Point &center, double &radius);
+
+    // Shapes that know the gradient of their distance estimator override this
+    // and return true. The result does not need to be normalized.
+    virtual bool gradient(Point const &position, Vector &gradient);
+
+    // Fraction of the march steps saved by over-relaxation, measured by also
+    // running the plain march for a sample of the rays.
+    double relaxationSavings() const;
+    size_t relaxationSamples() const;
+
+protected:
+    // Whether the batch distance estimators use AVX2, which follows the
+    // kernel selected for the primitives, see PrimitiveArrays::kernel.
+    static bool useAvx2();
+
 private:
+    // Bounding sphere after applying the operations, if any.
+    bool bounded = false;
+    Point boundsCenter;
+    double boundsRadius = 0.0;
+
+    // The operations folded into an affine transform, an optional repeat,
+    // a second affine transform and a distance scale. Only used if fused.
+    bool fused = false;
+    AffineTransform preRepeat;
+    bool repeated = false;
+    Repeat repeat{Vector()};
+    AffineTransform postRepeat;
+    double distanceScale = 1.0;
+
+    static size_t const relaxationSampleInterval = 64;
+    std::atomic<size_t> relaxationSampleCount{0};
+    std::atomic<size_t> relaxedSampleSteps{0};
+    std::atomic<size_t> plainSampleSteps{0};
+
+    // Why a march ended.
+    enum class MarchExit
+    {
+        Hit,
+        BeyondMaxT,
+        OutOfSteps
+    };
+
+    void fuseOperations();
+    bool fusionMatches();
+    bool clip(Ray const &ray, double &tMin, double &tMax) const;
+    double march(Ray const &ray, double maxT);
+    double march(Ray const &ray, double tMin, double maxT, double omega, size_t &steps,
+                 MarchExit &exit);
+    void march(RayPacket const &packet, RayPacket::Mask mask, double const *tMin,
+               double const *maxT, double *t, size_t *steps, MarchExit *exits);
+    void recordMarch(Ray const &ray, double tMin, double maxT, MarchExit exit, size_t steps);
     double calculateDistance(Point const &position);
+    void calculateDistances(size_t count, double const *x, double const *y, double const *z,
+                            double *distances);
+    void calculateDistances(Point const *positions, size_t count, double *distances);
     Vector calculateNormal(Point const &hit);
+    Vector centralDifferencesNormal(Point const &hit);
+    Vector tetrahedralNormal(Point const &hit);
 
     void transformPosition(Point &position);
     void transformDistance(double &distance);
+    void transformGradient(Vector &gradient);
 };
 
 #endif
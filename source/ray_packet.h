@@ -0,0 +1,49 @@
+#ifndef RAY_PACKET_H_
+#define RAY_PACKET_H_
+
+#include "ray.h"
+
+#include <cstdint>
+
+// Primary rays through neighbouring pixels, which are traced together. Such
+// coherent rays mostly visit the same nodes of the hierarchy and take
+// similar ray marching steps, so a packet shares the node visits and marches
+// all of its rays in one loop. Every ray is a lane of the packet, with its
+// origin and inverse direction also kept in arrays over the lanes for the
+// vectorized node tests. The rays keep their own origins, depth of field
+// moves them apart. Sets of lanes are given by bit masks.
+class RayPacket
+{
+    public:
+        typedef uint32_t Mask;
+
+        static unsigned const maxSize = 16;
+
+        Ray const *rays[maxSize];       // not owned
+        double origin[3][maxSize];
+        double inverse[3][maxSize];     // of the direction
+        unsigned size = 0;
+
+        void add(Ray const &ray)
+        {
+            for (unsigned axis = 0; axis != 3; ++axis)
+            {
+                origin[axis][size] = ray.O.data[axis];
+                inverse[axis][size] = 1.0 / ray.D.data[axis];
+            }
+            rays[size++] = &ray;
+        }
+
+        void clear()
+        {
+            size = 0;
+        }
+
+        // All lanes.
+        Mask lanes() const
+        {
+            return (Mask(1) << size) - 1;
+        }
+};
+
+#endif
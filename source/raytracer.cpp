@@ -1,8 +1,12 @@
 #include "raytracer.h"
 
+#include "band_writer.h"
+#include "distributed.h"
 #include "image.h"
 #include "light.h"
 #include "material.h"
+#include "png_writer.h"
+#include "tile_scheduler.h"
 #include "triple.h"
 
 // =============================================================================
@@ -37,13 +41,62 @@
 
 #include "json/json.h"
 
+#include <chrono>
+#include <cstdio>
 #include <exception>
 #include <fstream>
+#include <memory>
 #include <iostream>
+#include <thread>
 
 using namespace std;        // no std:: required
 using json = nlohmann::json;
 
+namespace
+{
+    // Images are written to a temporary file first, which then replaces
+    // the output, so that the output is never seen half written, e.g. when
+    // a progressive render is killed at a deadline.
+    string temporaryFile(string const &ofname)
+    {
+        return ofname + ".tmp";
+    }
+
+    bool replaceOutput(string const &ofname)
+    {
+        if (rename(temporaryFile(ofname).c_str(), ofname.c_str()) != 0)
+        {
+            cerr << "Error: could not write " << ofname << ".\n";
+            return false;
+        }
+        return true;
+    }
+
+    // A failed write keeps the existing output file.
+    template <typename Picture>     // Image or Framebuffer
+    bool writePng(Picture const &img, string const &ofname)
+    {
+        if (not img.write_png(temporaryFile(ofname)))
+        {
+            remove(temporaryFile(ofname).c_str());
+            return false;
+        }
+        return replaceOutput(ofname);
+    }
+
+    // 64 bit FNV-1a hash.
+    uint64_t fnvHash(string const &text)
+    {
+        uint64_t result = 14695981039346656037ull;
+        for (unsigned char character : text)
+        {
+            result ^= character;
+            result *= 1099511628211ull;
+        }
+        return result;
+    }
+}
+
 bool Raytracer::parseObjectNode(json const &node)
 {
     ObjectPtr obj = nullptr;
@@ -165,11 +218,11 @@ Material Raytracer::parseMaterialNode(json const &node) const
     if (node.count("texture"))
     {
         string imagePath = node["texture"];
-        Image im(imagePath);
-        return Material(im, ka, kd, ks, n);
+        if (TexturePtr texture = Texture::load(imagePath))
+            return Material(texture, ka, kd, ks, n);
     }
 
-    // No color or texture specified
+    // No color or readable texture specified
     return Material(Color(1, 0, 1), ka, kd, ks, n);
 }
 
@@ -184,11 +237,28 @@ void Raytracer::parseRayMarchedObjectNode(nlohmann::json const &node, RayMarched
     if (node.count("maxDistance"))
         obj->maxDistance = (node["maxDistance"]);
 
+    if (node.count("overRelaxation"))
+        obj->overRelaxation = (node["overRelaxation"]);
+
+    if (node.count("normalMode"))
+    {
+        if (node["normalMode"] == "central")
+            obj->normalMode = RayMarchedObject::NormalMode::CentralDifferences;
+        else if (node["normalMode"] == "tetrahedral")
+            obj->normalMode = RayMarchedObject::NormalMode::Tetrahedral;
+        else if (node["normalMode"] == "analytic")
+            obj->normalMode = RayMarchedObject::NormalMode::Analytic;
+        else
+            cerr << "Unknown normal mode: " << node["normalMode"] << ".\n";
+    }
+
     if (node.count("Operations"))
     {
         for (auto const &operationNode : node["Operations"])
             obj->operations.push_back(parseOperationNode(operationNode));
     }
+
+    obj->initialize();
 }
 
 Operation *Raytracer::parseOperationNode(nlohmann::json const &node) const
@@ -205,7 +275,11 @@ Operation *Raytracer::parseOperationNode(nlohmann::json const &node) const
     }
     else if (node["type"] == "scale")
     {
+        // A negative scale would mirror the shape, which the distance and
+        // bounds of Scale do not handle.
         double scale = node["scale"];
+        if (not (scale > 0.0))
+            throw runtime_error("The scale of a scale operation must be positive.");
         return new Scale(scale);
     }
     else if (node["type"] == "translate")
@@ -227,6 +301,10 @@ try
     json jsonscene;
     infile >> jsonscene;
 
+    // Identifies the scene in checkpoints, independent of the formatting.
+    sceneHash = fnvHash(jsonscene.dump());
+    sceneFile = ifname;
+
 // =============================================================================
 // -- Read your scene data in this section -------------------------------------
 // =============================================================================
@@ -274,6 +352,33 @@ try
         scene.setSuperSample(factor);
     }
 
+    if (jsonscene.count("AdaptiveSampling"))
+    {
+        bool enabled = jsonscene["AdaptiveSampling"];
+        scene.setAdaptiveSampling(enabled);
+    }
+
+    if (jsonscene.count("AdaptiveSamplingThreshold"))
+    {
+        double threshold = jsonscene["AdaptiveSamplingThreshold"];
+        scene.setAdaptiveThreshold(threshold);
+    }
+
+    if (jsonscene.count("Progressive"))
+        progressive = jsonscene["Progressive"];
+
+    if (jsonscene.count("TimeBudget"))
+        setTimeBudget(jsonscene["TimeBudget"]);
+
+    if (jsonscene.count("SampleBudget"))
+    {
+        sampleBudget = jsonscene["SampleBudget"];
+        progressive = true;
+    }
+
+    if (jsonscene.count("SnapshotInterval"))
+        snapshotInterval = jsonscene["SnapshotInterval"];
+
     if (jsonscene.count("Shadows"))
     {
         bool shadows = jsonscene["Shadows"];
@@ -298,6 +403,46 @@ try
         scene.setFocalLength(length);
     }
 
+    if (jsonscene.count("ConeMarching"))
+    {
+        bool enabled = jsonscene["ConeMarching"];
+        scene.setConeMarching(enabled);
+    }
+
+    if (jsonscene.count("PacketSize"))
+    {
+        unsigned size = jsonscene["PacketSize"];
+        setPacketSize(size);
+    }
+
+    if (jsonscene.count("Heatmap"))
+    {
+        string name = jsonscene["Heatmap"];
+        Heatmap::Metric metric;
+        if (Heatmap::parseMetric(name, metric))
+            setHeatmap(metric);
+        else
+            cerr << "Unknown heatmap metric " << name << ", no heatmap is written.\n";
+    }
+
+    if (jsonscene.count("Threads"))
+    {
+        unsigned threads = jsonscene["Threads"];
+        scene.setThreadCount(threads);
+    }
+
+    if (jsonscene.count("TileSize"))
+    {
+        unsigned size = jsonscene["TileSize"];
+        scene.setTileSize(size);
+    }
+
+    if (jsonscene.count("Seed"))
+    {
+        unsigned seed = jsonscene["Seed"];
+        scene.setSeed(seed);
+    }
+
     for (auto const &lightNode : jsonscene["Lights"])
         scene.addLight(parseLightNode(lightNode));
 
@@ -308,6 +453,8 @@ try
 
     cout << "Parsed " << objCount << " objects.\n";
 
+    scene.buildAccelerationStructure();
+
 // =============================================================================
 // -- End of scene data reading ------------------------------------------------
 // =============================================================================
@@ -320,12 +467,273 @@ catch (exception const &ex)
     return false;
 }
 
+void Raytracer::setThreadCount(unsigned count)
+{
+    scene.setThreadCount(count);
+}
+
+void Raytracer::setSeed(unsigned seed)
+{
+    scene.setSeed(seed);
+}
+
+void Raytracer::setSize(unsigned width, unsigned height)
+{
+    this->width = width;
+    this->height = height;
+}
+
+unsigned Raytracer::getWidth() const
+{
+    return width;
+}
+
+unsigned Raytracer::getHeight() const
+{
+    return height;
+}
+
+unsigned Raytracer::getTileSize() const
+{
+    return scene.getTileSize();
+}
+
+Statistics const &Raytracer::getStatistics() const
+{
+    return scene.getStatistics();
+}
+
+void Raytracer::writeStatistics(string const &ofname) const
+{
+    ofstream file(ofname);
+    file << scene.getStatistics().toJson().dump(4) << '\n';
+    if (not file)
+        cerr << "Error: could not write statistics to " << ofname << ".\n";
+}
+
+void Raytracer::setHeatmap(Heatmap::Metric metric)
+{
+    // Without the counters only time can be measured.
+    if (metric != Heatmap::Metric::Time and not Statistics::enabled)
+    {
+        cerr << "Warning: the " << Heatmap::unit(metric) << " heatmap requires"
+                " -DRAYTRACER_STATISTICS=ON, measuring time instead.\n";
+        metric = Heatmap::Metric::Time;
+    }
+
+    hasHeatmap = true;
+    heatmapMetric = metric;
+}
+
+void Raytracer::setTimeBudget(double seconds)
+{
+    timeBudget = seconds;
+    progressive = true;
+}
+
+// Renders one sample per pixel at a time, until the sample or time budget is
+// used up. The image so far is written to ofname every snapshotInterval.
+Framebuffer Raytracer::renderProgressive(string const &ofname, Heatmap *heatmap)
+{
+    using Clock = chrono::steady_clock;
+
+    unsigned samples = sampleBudget;
+    if (samples == 0)
+        samples = scene.getSuperSample() * scene.getSuperSample();
+
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = Clock::time_point::max();
+    if (timeBudget > 0.0)
+        deadline = start + chrono::duration_cast<Clock::duration>(chrono::duration<double>(timeBudget));
+    Clock::time_point nextSnapshot = start + chrono::duration_cast<Clock::duration>(
+                                                 chrono::duration<double>(snapshotInterval));
+
+    // The samples are summed in double precision, only the averages are
+    // stored in the (float) framebuffer.
+    vector<Color> sum(width * height);
+    vector<unsigned> counts(width * height, 0);
+    Framebuffer img(width, height, scene.getTileSize());
+    auto average = [&]()
+    {
+        for (unsigned y = 0; y != height; ++y)
+            for (unsigned x = 0; x != width; ++x)
+                if (counts[y * width + x] > 0)
+                    img.put_pixel(x, y, sum[y * width + x] / counts[y * width + x]);
+    };
+
+    unsigned pass = 0;
+    for (; pass != samples and Clock::now() < deadline; ++pass)
+    {
+        scene.renderPass(sum, counts, width, height, pass, deadline, heatmap);
+
+        if (Clock::now() >= nextSnapshot and pass + 1 != samples)
+        {
+            average();
+            cout << "Writing snapshot after " << pass + 1 << " samples per pixel...\n";
+            writePng(img, ofname);
+            nextSnapshot = Clock::now() + chrono::duration_cast<Clock::duration>(
+                                              chrono::duration<double>(snapshotInterval));
+        }
+    }
+
+    chrono::duration<double> elapsed = Clock::now() - start;
+    cout << "Rendered " << pass << " of " << samples << " samples per pixel in "
+         << elapsed.count() << " s.\n";
+
+    average();
+    return img;
+}
+
+void Raytracer::setCheckpoint(string const &filename, double interval)
+{
+    checkpointFile = filename;
+    checkpointInterval = interval;
+}
+
+void Raytracer::setWorkerCount(unsigned count, double timeout)
+{
+    workerCount = count;
+    workerTimeout = timeout;
+}
+
+void Raytracer::setPacketSize(unsigned size)
+{
+    // Larger packets would not fit in a RayPacket, and packets of 3 x 3
+    // pixels would leave lanes of the 4-wide distance estimators unused.
+    if (size != 1 and size != 2 and size != 4)
+    {
+        cerr << "Warning: packet size " << size << " is not 1, 2 or 4, using 1.\n";
+        size = 1;
+    }
+    scene.setPacketSize(size);
+}
+
+Framebuffer Raytracer::render(Heatmap *heatmap, Checkpoint *checkpoint)
+{
+    Framebuffer img(width, height, scene.getTileSize());
+    scene.render(img, heatmap, checkpoint);
+    return img;
+}
+
+void Raytracer::renderTiles(vector<unsigned> const &indices, unsigned seed,
+                            function<void(Tile const &, Framebuffer const &, Heatmap const *)> const &finished)
+{
+    scene.renderTiles(width, height, indices, seed, hasHeatmap, heatmapMetric, finished);
+}
+
+// Renders on workerCount child processes, which share the hardware threads
+// unless the thread count is set.
+Framebuffer Raytracer::renderDistributed(Heatmap *heatmap)
+{
+    unsigned threads = scene.getThreadCount();
+    if (threads == 0)
+        threads = max(thread::hardware_concurrency() / workerCount, 1u);
+
+    Job job;
+    job.width = width;
+    job.height = height;
+    job.seed = scene.renderSeed();
+    job.threadCount = threads;
+    job.heatmap = heatmap ? 1 + static_cast<uint32_t>(heatmapMetric) : 0;
+    job.packetSize = scene.getPacketSize();
+
+    cout << "Rendering on " << workerCount << " worker processes...\n";
+    Framebuffer img(width, height, scene.getTileSize());
+    TileScheduler tiling(width, height, scene.getTileSize(), 1);
+    Coordinator coordinator(sceneFile, workerCount,
+                            chrono::ceil<chrono::milliseconds>(chrono::duration<double>(workerTimeout)));
+    vector<unsigned> remaining = coordinator.render(job, tiling.tiles(), img, heatmap);
+
+    if (not remaining.empty())
+    {
+        cerr << "Warning: all workers failed, rendering the remaining "
+             << remaining.size() << " tiles in this process.\n";
+        renderTiles(remaining, job.seed, [&](Tile const &tile, Framebuffer const &pixels,
+                                             Heatmap const *costs)
+        {
+            for (unsigned y = tile.y0; y != tile.y1; ++y)
+            {
+                for (unsigned x = tile.x0; x != tile.x1; ++x)
+                {
+                    img.put_pixel(x, y, pixels.get_pixel(x - tile.x0, y - tile.y0));
+                    if (heatmap)
+                        (*heatmap)(x, y) = (*costs)(x - tile.x0, y - tile.y0);
+                }
+            }
+        });
+    }
+    return img;
+}
+
 void Raytracer::renderToFile(string const &ofname)
 {
-    Image img(width, height);
+    // The images are compressed on as many threads as they are rendered.
+    PngWriter::setThreadCount(scene.getThreadCount());
+
     cout << "Tracing...\n";
-    scene.render(img);
+    unique_ptr<Heatmap> heatmap;
+    if (hasHeatmap)
+        heatmap.reset(new Heatmap(width, height, heatmapMetric));
+
+    unique_ptr<Checkpoint> checkpoint;
+    if (not checkpointFile.empty())
+    {
+        if (progressive or workerCount > 0)
+            cerr << "Warning: progressive and distributed renders are not checkpointed.\n";
+        else
+            checkpoint.reset(new Checkpoint(checkpointFile, checkpointInterval, sceneHash));
+    }
+
+    if (progressive and workerCount > 0)
+        cerr << "Warning: progressive renders are not distributed.\n";
+
+    Framebuffer img;
+    bool streamed = false;
+    if (progressive)
+        img = renderProgressive(ofname, heatmap.get());
+    else if (workerCount > 0)
+        img = renderDistributed(heatmap.get());
+    else
+    {
+        // The image is written while it is rendered, see BandWriter.
+        img = Framebuffer(width, height, scene.getTileSize());
+        TileScheduler tiling(width, height, scene.getTileSize(), 1);
+        BandWriter output(temporaryFile(ofname), img, tiling.tiles(), scene.getTileSize());
+        scene.render(img, heatmap.get(), checkpoint.get(),
+                     [&](Tile const &tile) { output.finish(tile); });
+        streamed = output.close();
+    }
+
+    for (ObjectPtr const &obj : scene.getObjects())
+    {
+        auto *rayMarchedObj = dynamic_cast<RayMarchedObject*>(obj.get());
+        if (rayMarchedObj and rayMarchedObj->relaxationSamples() > 0)
+            cout << "Over-relaxation saved " << 100.0 * rayMarchedObj->relaxationSavings()
+                 << "% of the march steps (sampled " << rayMarchedObj->relaxationSamples()
+                 << " rays).\n";
+    }
+
+    if (Statistics::enabled)
+        scene.getStatistics().print(cout);
+
     cout << "Writing image to " << ofname << "...\n";
-    img.write_png(ofname);
+    bool written = streamed ? replaceOutput(ofname) : writePng(img, ofname);
+
+    // The render is complete, it will not be resumed, unless the image
+    // could not be written.
+    if (checkpoint and written)
+        checkpoint->remove();
+
+    if (heatmap)
+    {
+        // Written next to the image, e.g. scene_heatmap.png for scene.png.
+        string heatmapName = ofname.substr(0, ofname.find_last_of('.')) + "_heatmap.png";
+        uint64_t scale;
+        Image heatmapImage = heatmap->toImage(scale);
+        cout << "Writing heatmap to " << heatmapName << " (red is " << scale << ' '
+             << Heatmap::unit(heatmapMetric) << " per pixel or more)...\n";
+        writePng(heatmapImage, heatmapName);
+    }
+
     cout << "Done.\n";
 }
@@ -1,11 +1,18 @@
 #ifndef RAYTRACER_H_
 #define RAYTRACER_H_
 
+#include "checkpoint.h"
+#include "framebuffer.h"
+#include "heatmap.h"
+#include "image.h"
 #include "scene.h"
 #include "ray_marched_object.h"
 #include "operations/operation.h"
 
+#include <cstdint>
+#include <functional>
 #include <string>
+#include <vector>
 
 // Forward declarations
 class Light;
@@ -17,14 +24,61 @@ class Raytracer
 {
     Scene scene;
     unsigned width, height;
+    bool hasHeatmap = false;
+    Heatmap::Metric heatmapMetric = Heatmap::Metric::Time;
+
+    // Progressive rendering, see renderProgressive.
+    bool progressive = false;
+    double timeBudget = 0.0;        // seconds, 0 for no limit
+    unsigned sampleBudget = 0;      // per pixel, 0 for the super sampling grid
+    double snapshotInterval = 10.0; // seconds
+
+    // Checkpointing, see Checkpoint.
+    uint64_t sceneHash = 0;
+    std::string checkpointFile;
+    double checkpointInterval = 60.0;   // seconds
+
+    // Distributed rendering, see Coordinator.
+    std::string sceneFile;
+    unsigned workerCount = 0;           // 0 renders in this process
+    double workerTimeout = 300.0;       // seconds without progress, 0 for none
 
     public:
 
         bool readScene(std::string const &ifname);
         void renderToFile(std::string const &ofname);
+        Framebuffer render(Heatmap *heatmap = nullptr, Checkpoint *checkpoint = nullptr);
+
+        // Renders some tiles of the image, with their costs if a heatmap is
+        // set, see Scene::renderTiles.
+        void renderTiles(std::vector<unsigned> const &indices, unsigned seed,
+                         std::function<void(Tile const &, Framebuffer const &,
+                                            Heatmap const *)> const &finished);
+
+        // Overrides for the corresponding scene file settings.
+        void setThreadCount(unsigned count);
+        void setSeed(unsigned seed);
+        void setSize(unsigned width, unsigned height);
+        void setHeatmap(Heatmap::Metric metric);
+        void setTimeBudget(double seconds);     // enables progressive rendering
+        void setCheckpoint(std::string const &filename, double interval);
+        void setWorkerCount(unsigned count, double timeout);    // worker processes
+        void setPacketSize(unsigned size);      // pixels per side, 1 disables packets
+
+        unsigned getWidth() const;
+        unsigned getHeight() const;
+        unsigned getTileSize() const;
+
+        // Counters of the last render, only collected if RAYTRACER_STATISTICS
+        // is defined.
+        Statistics const &getStatistics() const;
+        void writeStatistics(std::string const &ofname) const;
 
     private:
 
+        Framebuffer renderProgressive(std::string const &ofname, Heatmap *heatmap);
+        Framebuffer renderDistributed(Heatmap *heatmap);
+
         bool parseObjectNode(nlohmann::json const &node);
 
         Light parseLightNode(nlohmann::json const &node) const;
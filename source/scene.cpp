@@ -1,40 +1,154 @@
 #include "scene.h"
 
+#include "checkpoint.h"
+#include "framebuffer.h"
+#include "heatmap.h"
 #include "hit.h"
-#include "image.h"
 #include "material.h"
 #include "ray.h"
+#include "ray_marched_object.h"
+#include "ray_packet.h"
+#include "tile_scheduler.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <functional>
 #include <limits>
+#include <memory>
+#include <mutex>
 #include <random>
 
 using namespace std;
 
+namespace
+{
+    // Up to this many spheres and quads are tested in a loop over their
+    // packed arrays. Beyond about this count the hierarchy, which skips
+    // most of them, is faster.
+    size_t const maxPackedPrimitives = 24;
+
+    // Size in pixels of the blocks for which the cone marching is refined.
+    unsigned const coneBlockSize = 4;
+
+    // Largest packet size, RayPacket::maxSize pixels.
+    unsigned const maxPacketSize = 4;
+
+    // Largest difference between the channels of two colors.
+    double contrast(Color const &lhs, Color const &rhs)
+    {
+        return max(abs(lhs.r - rhs.r), max(abs(lhs.g - rhs.g), abs(lhs.b - rhs.b)));
+    }
+}
+
+void Scene::buildAccelerationStructure()
+{
+    size_t primitiveCount = count_if(objects.begin(), objects.end(), [](ObjectPtr const &obj)
+    {
+        return PrimitiveArrays::accepts(*obj);
+    });
+    bool packPrimitives = primitiveCount <= maxPackedPrimitives;
+
+    vector<ObjectPtr> boundedObjects;
+    primitives.clear();
+    unboundedObjects.clear();
+    rayMarchedObjects.clear();
+    for (ObjectPtr const &obj : objects)
+    {
+        if (auto *rayMarchedObj = dynamic_cast<RayMarchedObject*>(obj.get()))
+            rayMarchedObjects.push_back(rayMarchedObj);
+
+        if (packPrimitives and PrimitiveArrays::accepts(*obj))
+            primitives.add(obj);
+        else if (obj->bounds().isBounded())
+            boundedObjects.push_back(obj);
+        else
+            unboundedObjects.push_back(obj);
+    }
+
+    bvh.build(boundedObjects);
+}
+
 pair<ObjectPtr, Hit> Scene::castRay(Ray const &ray) const
 {
     // Find hit object and distance
     Hit min_hit(numeric_limits<double>::infinity(), Vector());
-    ObjectPtr obj = nullptr;
-    for (unsigned idx = 0; idx != objects.size(); ++idx)
+    ObjectPtr obj = primitives.intersect(ray, min_hit);
+    if (ObjectPtr bounded = bvh.intersect(ray, min_hit))
+        obj = bounded;
+    for (ObjectPtr const &unbounded : unboundedObjects)
     {
-        Hit hit(objects[idx]->intersect(ray));
+        if (Statistics::enabled)
+            Statistics::local().countIntersectionTest(*unbounded);
+
+        Hit hit(unbounded->intersect(ray));
         if (hit.t < min_hit.t)
         {
             min_hit = hit;
-            obj = objects[idx];
+            obj = unbounded;
         }
     }
 
     return pair<ObjectPtr, Hit>(obj, min_hit);
 }
 
+void Scene::castPacket(RayPacket const &packet, Hit *minHits, ObjectPtr *objects) const
+{
+    for (unsigned lane = 0; lane != packet.size; ++lane)
+    {
+        minHits[lane] = Hit(numeric_limits<double>::infinity(), Vector());
+        objects[lane] = primitives.intersect(*packet.rays[lane], minHits[lane]);
+    }
+
+    bvh.intersect(packet, minHits, objects);
+    for (ObjectPtr const &unbounded : unboundedObjects)
+    {
+        if (Statistics::enabled)
+        {
+            for (unsigned lane = 0; lane != packet.size; ++lane)
+                Statistics::local().countIntersectionTest(*unbounded);
+        }
+
+        RayPacket::Mask closer = unbounded->intersectPacket(packet, packet.lanes(), minHits);
+        for (unsigned lane = 0; lane != packet.size; ++lane)
+            if (closer >> lane & 1)
+                objects[lane] = unbounded;
+    }
+}
+
+bool Scene::occluded(Ray const &ray, double maxT) const
+{
+    // The primitives and the hierarchy are usually much cheaper than the
+    // unbounded objects.
+    if (primitives.occluded(ray, maxT) or bvh.occluded(ray, maxT))
+        return true;
+
+    for (ObjectPtr const &unbounded : unboundedObjects)
+    {
+        if (Statistics::enabled)
+            Statistics::local().countIntersectionTest(*unbounded);
+
+        if (unbounded->occludes(ray, maxT))
+            return true;
+    }
+
+    return false;
+}
+
 Color Scene::trace(Ray const &ray, unsigned depth)
 {
     pair<ObjectPtr, Hit> mainhit = castRay(ray);
-    ObjectPtr obj = mainhit.first;
-    Hit min_hit = mainhit.second;
+    return shade(ray, mainhit.first, mainhit.second, depth);
+}
+
+Color Scene::shade(Ray const &ray, ObjectPtr const &obj, Hit const &min_hit, unsigned depth)
+{
+    if (Statistics::enabled)
+    {
+        Statistics &statistics = Statistics::local();
+        ++(depth == recursionDepth ? statistics.primaryRays : statistics.secondaryRays);
+        ++statistics.depthHistogram[min(recursionDepth - depth, Statistics::depthLevels - 1)];
+    }
 
     // No hit? Return background color.
     if (!obj)
@@ -45,7 +159,8 @@ Color Scene::trace(Ray const &ray, unsigned depth)
     Vector V = -ray.D;
 
     // Pre-condition: For closed objects, N points outwards.
-    Vector N = min_hit.N;
+    // Only the closest hit needs a normal, so it is evaluated here.
+    Vector N = obj->normal(min_hit);
 
     // The shading normal always points in the direction of the view,
     // as required by the Phong illumination model.
@@ -55,7 +170,8 @@ Color Scene::trace(Ray const &ray, unsigned depth)
     else
         shadingN = -N;
 
-    Color matColor = material.color;
+    Color matColor = material.hasTexture ? sampleTexture(ray, *obj, hit, N, min_hit.t)
+                                         : material.color;
 
     // Add ambient once, regardless of the number of lights.
     Color color = material.ka * matColor;
@@ -69,16 +185,13 @@ Color Scene::trace(Ray const &ray, unsigned depth)
         {
             // Cast a ray from the hit to the light source.
             Ray shadowRay(hit + epsilon * shadingN, L); // Move a bit along the normal to prevent shadow acne.
-            pair<ObjectPtr, Hit> shadowHit = castRay(shadowRay);
 
-            // Check whether the shadow ray intersected an object.
-            if (shadowHit.first)
-            {
-                // We only skip this light's contribution if the intersected object was between the hit and the light.
-                double distanceToLight = (light->position - hit).length();
-                if (shadowHit.second.t < distanceToLight) 
-                    continue; // Skip this light's contribution.
-            }
+            // We only skip this light's contribution if an object lies between the hit and the light.
+            double distanceToLight = (light->position - hit).length();
+            if (Statistics::enabled)
+                ++Statistics::local().shadowRays;
+            if (occluded(shadowRay, distanceToLight))
+                continue; // Skip this light's contribution.
         }
 
         // Add diffuse.
@@ -101,7 +214,7 @@ Color Scene::trace(Ray const &ray, unsigned depth)
     {
         // Trace a ray in the reflected direction.
         Vector reflectDir = reflect(-V, shadingN);
-        Ray reflectRay(hit + epsilon * shadingN, reflectDir);
+        Ray reflectRay = spawnRay(ray, min_hit.t, hit + epsilon * shadingN, reflectDir);
         Color reflectColor = trace(reflectRay, depth - 1);
 
         // Determine incident and transimitant refraction indices as well as cos(phi).
@@ -127,7 +240,7 @@ Color Scene::trace(Ray const &ray, unsigned depth)
             return color + reflectColor;
 
         // Trace a ray in the refracted direction.
-        Ray refractRay(hit - epsilon * shadingN, refractDir);
+        Ray refractRay = spawnRay(ray, min_hit.t, hit - epsilon * shadingN, refractDir);
         Color refractColor = trace(refractRay, depth - 1);
 
         // Schlick’s approximation.
@@ -142,7 +255,7 @@ Color Scene::trace(Ray const &ray, unsigned depth)
     {
         // Trace a ray in the reflected direction.
         Vector reflectDir = reflect(-V, shadingN);
-        Ray reflectRay(hit + epsilon * shadingN, reflectDir);
+        Ray reflectRay = spawnRay(ray, min_hit.t, hit + epsilon * shadingN, reflectDir);
         Color reflectColor = trace(reflectRay, depth - 1);
 
         // Multiply the resulting color by the specular component and add it to the output color.
@@ -152,59 +265,550 @@ Color Scene::trace(Ray const &ray, unsigned depth)
     return color;
 }
 
-void Scene::render(Image &img)
+void Scene::render(Framebuffer &img, Heatmap *heatmap, Checkpoint *checkpoint,
+                   function<void(Tile const &)> const &finished)
 {
     unsigned w = img.width();
     unsigned h = img.height();
     aspectRatio = static_cast<double>(w) / static_cast<double>(h);
 
-    std::random_device randomDevice;
-    std::default_random_engine randomEngine(randomDevice());
-    std::uniform_real_distribution<double> uniformDistribution(-1.0, 1.0);
+    unsigned baseSeed = renderSeed();
+    TileScheduler scheduler(w, h, tileSize, threadCount);
+
+    // A resumed render continues with the seed it started with.
+    if (checkpoint)
+        baseSeed = checkpoint->start(img, scheduler.tiles(), tileSize, baseSeed, hasSeed);
 
-    for (unsigned y = 0; y < h; ++y)
+    renderStatistics = Statistics();
+    forEachTile(scheduler, [&](Tile const &tile)
     {
-        for (unsigned x = 0; x < w; ++x)
+        if (checkpoint and checkpoint->isFinished(tile))
         {
-            Color color(0.0, 0.0, 0.0);
-            for (unsigned i = 0; i < supersamplingFactor; ++i)
+            if (finished)
+                finished(tile);
+            return;
+        }
+
+        // Each tile gets its own random stream, so the result does not
+        // depend on the number of threads or on which worker took the tile.
+        std::seed_seq seedSequence{baseSeed, tile.index};
+        std::default_random_engine randomEngine(seedSequence);
+        renderTile(img, tile, w, h, 0, 0, randomEngine, heatmap);
+
+        if (checkpoint)
+            checkpoint->finish(tile, img);
+        if (finished)
+            finished(tile);
+    });
+}
+
+void Scene::renderTiles(unsigned w, unsigned h, vector<unsigned> const &indices, unsigned baseSeed,
+                        bool heatmap, Heatmap::Metric metric,
+                        function<void(Tile const &, Framebuffer const &, Heatmap const *)> const &finished)
+{
+    aspectRatio = static_cast<double>(w) / static_cast<double>(h);
+
+    TileScheduler scheduler(w, h, tileSize, threadCount);
+    vector<uint8_t> selected(scheduler.tiles().size(), 0);
+    for (unsigned index : indices)
+        selected[index] = 1;
+
+    renderStatistics = Statistics();
+    forEachTile(scheduler, [&](Tile const &tile)
+    {
+        if (not selected[tile.index])
+            return;
+
+        // Only the tile is held in memory, not the whole image.
+        unsigned tileWidth = tile.x1 - tile.x0;
+        unsigned tileHeight = tile.y1 - tile.y0;
+        Framebuffer img(tileWidth, tileHeight, max(tileWidth, tileHeight));
+        unique_ptr<Heatmap> costs;
+        if (heatmap)
+            costs.reset(new Heatmap(tileWidth, tileHeight, metric));
+
+        // The same random stream as in render, so that the tiles match.
+        std::seed_seq seedSequence{baseSeed, tile.index};
+        std::default_random_engine randomEngine(seedSequence);
+        renderTile(img, tile, w, h, tile.x0, tile.y0, randomEngine, costs.get());
+        finished(tile, img, costs.get());
+    });
+}
+
+unsigned Scene::renderSeed() const
+{
+    // Without a fixed seed every render gets a different depth of field jitter.
+    return hasSeed ? seed : std::random_device()();
+}
+
+void Scene::renderPass(vector<Color> &sum, vector<unsigned> &counts, unsigned w, unsigned h,
+                       unsigned pass, chrono::steady_clock::time_point deadline, Heatmap *heatmap)
+{
+    aspectRatio = static_cast<double>(w) / static_cast<double>(h);
+
+    unsigned baseSeed = renderSeed();
+
+    TileScheduler scheduler(w, h, tileSize, threadCount);
+    if (pass == 0)
+    {
+        renderStatistics = Statistics();
+        passStarts.assign(scheduler.tiles().size(), vector<double>());
+    }
+    forEachTile(scheduler, [&](Tile const &tile)
+    {
+        // Tiles that have not started by the deadline keep the samples of
+        // the previous passes.
+        if (chrono::steady_clock::now() >= deadline)
+            return;
+
+        std::seed_seq seedSequence{baseSeed, tile.index, pass};
+        std::default_random_engine randomEngine(seedSequence);
+        std::uniform_real_distribution<double> offsetDistribution(0.0, 1.0);
+        // The march starts only depend on the tile, so they are computed on
+        // the first pass that reaches it and reused by the later passes.
+        vector<double> &starts = passStarts[tile.index];
+        if (starts.empty())
+            starts = marchStarts(tile, w, h);
+
+        // The first passes take the super sampling grid, starting with the
+        // sample nearest to the pixel center. Later passes sample at random.
+        unsigned gridSize = supersamplingFactor * supersamplingFactor;
+        unsigned center = (supersamplingFactor - 1) / 2;
+        unsigned gridSample = (pass + center * supersamplingFactor + center) % gridSize;
+        double gridX = (1.0 + gridSample / supersamplingFactor) / (1.0 + supersamplingFactor);
+        double gridY = (1.0 + gridSample % supersamplingFactor) / (1.0 + supersamplingFactor);
+
+        // The tile is rendered in bands of rows (one row of packets), and
+        // the deadline is checked again before every band, so that a pass
+        // over large tiles does not overrun it by much. The remaining rows
+        // keep the samples of the previous passes.
+        bool packets = packetSize > 1 and not heatmap;
+        unsigned bandHeight = packets ? min(packetSize, maxPacketSize) : 1;
+        unsigned tileWidth = tile.x1 - tile.x0;
+        for (unsigned y0 = tile.y0; y0 < tile.y1; y0 += bandHeight)
+        {
+            if (y0 != tile.y0 and chrono::steady_clock::now() >= deadline)
+                return;
+
+            Tile band = tile;
+            band.y0 = y0;
+            band.y1 = min(y0 + bandHeight, tile.y1);
+
+            vector<Ray> rays;
+            rays.reserve((band.y1 - band.y0) * tileWidth);
+            for (unsigned y = band.y0; y < band.y1; ++y)
+            {
+                for (unsigned x = band.x0; x < band.x1; ++x)
+                {
+                    double xOffset = gridX;
+                    double yOffset = gridY;
+                    if (pass >= gridSize)
+                    {
+                        xOffset = offsetDistribution(randomEngine);
+                        yOffset = offsetDistribution(randomEngine);
+                    }
+
+                    double marchStart = starts[(y - tile.y0) * tileWidth + x - tile.x0];
+                    rays.push_back(primaryRay(x + xOffset, y + yOffset, w, h, marchStart, randomEngine));
+                }
+            }
+
+            vector<Color> colors;
+            if (packets)
+                colors = tracePackets(rays, band, 1);
+
+            auto ray = rays.begin();
+            auto color = colors.begin();
+            for (unsigned y = band.y0; y < band.y1; ++y)
+            {
+                for (unsigned x = band.x0; x < band.x1; ++x, ++ray)
+                {
+                    uint64_t costStart = heatmap ? heatmap->counter() : 0;
+
+                    Color sample = packets ? *color++ : trace(*ray, recursionDepth).clamp();
+                    sum[y * w + x] += sample;
+                    ++counts[y * w + x];
+
+                    if (heatmap)
+                        (*heatmap)(x, y) += heatmap->counter() - costStart;
+                }
+            }
+        }
+    });
+}
+
+// Calls renderTile for every tile on the worker threads, and collects the
+// statistics of the tiles.
+void Scene::forEachTile(TileScheduler const &scheduler, function<void(Tile const &)> const &renderTile)
+{
+    mutex statisticsMutex;
+
+    scheduler.run([&](Tile const &tile, unsigned worker)
+    {
+        renderTile(tile);
+
+        // Collect the counters of the tile from the worker.
+        if (Statistics::enabled)
+        {
+            lock_guard<mutex> lock(statisticsMutex);
+            renderStatistics.add(Statistics::local());
+            Statistics::local() = Statistics();
+        }
+    });
+}
+
+// Renders the tile of the w x h image. Pixel (x, y) of the image goes to
+// (x - x0, y - y0) of img and the heatmap, which hold the whole image or
+// only the tile.
+void Scene::renderTile(Framebuffer &img, Tile const &tile, unsigned w, unsigned h, unsigned x0,
+                       unsigned y0, std::default_random_engine &randomEngine, Heatmap *heatmap)
+{
+    bool adaptive = adaptiveSampling and supersamplingFactor > 1;
+
+    // Adaptive sampling compares pixels with their neighbours, so it also
+    // samples the pixels around the tile, to find edges along its border.
+    // Those estimates are traced again by the neighbouring tiles (a ring of
+    // about 4 / tileSize of the tile's estimates), but tiles stay
+    // independent, which checkpoints, workers and progressive passes rely on.
+    Tile region = tile;
+    if (adaptive)
+    {
+        region.x0 = max(tile.x0, 1u) - 1;
+        region.y0 = max(tile.y0, 1u) - 1;
+        region.x1 = min(tile.x1 + 1, w);
+        region.y1 = min(tile.y1 + 1, h);
+    }
+    unsigned regionWidth = region.x1 - region.x0;
+    vector<double> starts = marchStarts(region, w, h);
+
+    auto offset = [&](unsigned idx)
+    {
+        return (1.0 + idx) / (1.0 + supersamplingFactor);
+    };
+
+    // Packets are traced for many pixels at once, the cost of a single
+    // pixel is not known.
+    bool packets = packetSize > 1 and not heatmap;
+
+    // The primary rays are made up front, in the order in which they take
+    // their random numbers, so that the image does not depend on whether
+    // they are traced in packets.
+    if (not adaptive)
+    {
+        unsigned samples = supersamplingFactor * supersamplingFactor;
+        vector<Ray> rays;
+        rays.reserve(starts.size() * samples);
+        for (unsigned y = tile.y0; y < tile.y1; ++y)
+        {
+            for (unsigned x = tile.x0; x < tile.x1; ++x)
+            {
+                double marchStart = starts[(y - region.y0) * regionWidth + x - region.x0];
+                for (unsigned i = 0; i < supersamplingFactor; ++i)
+                    for (unsigned j = 0; j < supersamplingFactor; ++j)
+                        rays.push_back(primaryRay(x + offset(i), y + offset(j), w, h, marchStart,
+                                                  randomEngine));
+            }
+        }
+
+        vector<Color> colors;
+        if (packets)
+            colors = tracePackets(rays, tile, samples);
+
+        auto ray = rays.begin();
+        auto sample = colors.begin();
+        for (unsigned y = tile.y0; y < tile.y1; ++y)
+        {
+            for (unsigned x = tile.x0; x < tile.x1; ++x)
+            {
+                uint64_t costStart = heatmap ? heatmap->counter() : 0;
+
+                // Super sampling.
+                Color color(0.0, 0.0, 0.0);
+                for (unsigned idx = 0; idx != samples; ++idx, ++ray)
+                    color += packets ? *sample++ : trace(*ray, recursionDepth).clamp();
+
+                img.put_pixel(x - x0, y - y0, color / (supersamplingFactor * supersamplingFactor));
+
+                if (heatmap)
+                    (*heatmap)(x - x0, y - y0) = heatmap->counter() - costStart;
+            }
+        }
+        return;
+    }
+
+    // First estimate every pixel of the region by the sample nearest to its
+    // center. The heatmap only records the pixels of the tile itself, the
+    // others belong to other tiles.
+    unsigned center = (supersamplingFactor - 1) / 2;
+    vector<Ray> rays;
+    rays.reserve(starts.size());
+    for (unsigned y = region.y0; y < region.y1; ++y)
+    {
+        for (unsigned x = region.x0; x < region.x1; ++x)
+        {
+            unsigned idx = (y - region.y0) * regionWidth + x - region.x0;
+            rays.push_back(primaryRay(x + offset(center), y + offset(center), w, h, starts[idx],
+                                      randomEngine));
+        }
+    }
+
+    vector<Color> estimates;
+    if (packets)
+        estimates = tracePackets(rays, region, 1);
+    else
+    {
+        estimates.resize(rays.size());
+        for (unsigned y = region.y0; y < region.y1; ++y)
+        {
+            for (unsigned x = region.x0; x < region.x1; ++x)
             {
+                bool inTile = x >= tile.x0 and x < tile.x1 and y >= tile.y0 and y < tile.y1;
+                uint64_t costStart = heatmap and inTile ? heatmap->counter() : 0;
+
+                unsigned idx = (y - region.y0) * regionWidth + x - region.x0;
+                estimates[idx] = trace(rays[idx], recursionDepth).clamp();
+
+                if (heatmap and inTile)
+                    (*heatmap)(x - x0, y - y0) = heatmap->counter() - costStart;
+            }
+        }
+    }
+
+    // Then take the remaining samples only for the pixels that differ from
+    // one of their neighbours.
+    for (unsigned y = tile.y0; y < tile.y1; ++y)
+    {
+        for (unsigned x = tile.x0; x < tile.x1; ++x)
+        {
+            unsigned idx = (y - region.y0) * regionWidth + x - region.x0;
+            Color const &estimate = estimates[idx];
+
+            bool refine = false;
+            for (unsigned ny = max(y, region.y0 + 1) - 1; ny < min(y + 2, region.y1); ++ny)
+            {
+                for (unsigned nx = max(x, region.x0 + 1) - 1; nx < min(x + 2, region.x1); ++nx)
+                {
+                    Color const &neighbour = estimates[(ny - region.y0) * regionWidth + nx - region.x0];
+                    refine = refine or contrast(estimate, neighbour) > adaptiveThreshold;
+                }
+            }
+
+            if (not refine)
+            {
+                img.put_pixel(x - x0, y - y0, estimate);
+                continue;
+            }
+
+            if (Statistics::enabled)
+                ++Statistics::local().refinedPixels;
+
+            uint64_t costStart = heatmap ? heatmap->counter() : 0;
+
+            Color color = estimate;
+            for (unsigned i = 0; i < supersamplingFactor; ++i)
                 for (unsigned j = 0; j < supersamplingFactor; ++j)
+                    if (i != center or j != center)
+                        color += samplePixel(x + offset(i), y + offset(j), w, h, starts[idx], randomEngine);
+
+            img.put_pixel(x - x0, y - y0, color / (supersamplingFactor * supersamplingFactor));
+
+            if (heatmap)
+                (*heatmap)(x - x0, y - y0) += heatmap->counter() - costStart;
+        }
+    }
+}
+
+// Traces a primary ray through the given image coordinates.
+Color Scene::samplePixel(double xCoordinate, double yCoordinate, unsigned w, unsigned h,
+                         double marchStart, std::default_random_engine &randomEngine)
+{
+    Ray ray = primaryRay(xCoordinate, yCoordinate, w, h, marchStart, randomEngine);
+    return trace(ray, recursionDepth).clamp();
+}
+
+// The primary ray through the given image coordinates.
+Ray Scene::primaryRay(double xCoordinate, double yCoordinate, unsigned w, unsigned h,
+                      double marchStart, std::default_random_engine &randomEngine) const
+{
+    std::uniform_real_distribution<double> uniformDistribution(-1.0, 1.0);
+
+    // Determine the focal point.
+    Ray ray(eye, viewDirection(xCoordinate, yCoordinate, w, h));
+    Point focalPoint = ray.O + focalLength * ray.D;
+
+    // Shift the ray origin to simulate depth of field.
+    Point origin(ray.O);
+    origin.x += uniformDistribution(randomEngine) * depthOfFieldStrength;
+    origin.y += uniformDistribution(randomEngine) * depthOfFieldStrength;
+    ray.O = origin;
+
+    // Recalculate the ray direction.
+    Vector direction = (focalPoint - ray.O).normalized();
+    ray.D = direction;
+    ray.marchStart = marchStart;
+
+    // The ray covers the pixel, or its share of it when super sampling.
+    ray.spread = 2.0 * tan(fieldOfView / 2.0) / (h * supersamplingFactor);
+    return ray;
+}
+
+// Traces primary rays in packets of packetSize by packetSize pixels of the
+// region. The rays are ordered by pixel, row by row, and then by sample,
+// samples per pixel. A packet holds the same sample of all of its pixels.
+// Only the closest hits are found in packets, the rays are shaded (and the
+// secondary rays traced) one by one. Returns the colors in the same order.
+vector<Color> Scene::tracePackets(vector<Ray> const &rays, Tile const &region, unsigned samples)
+{
+    unsigned regionWidth = region.x1 - region.x0;
+    unsigned size = min(packetSize, maxPacketSize);
+    vector<Color> colors(rays.size());
+
+    RayPacket packet;
+    unsigned indices[RayPacket::maxSize];
+    vector<Hit> minHits(RayPacket::maxSize, Hit::NO_HIT());
+    vector<ObjectPtr> objects(RayPacket::maxSize);
+    for (unsigned y0 = region.y0; y0 < region.y1; y0 += size)
+    {
+        for (unsigned x0 = region.x0; x0 < region.x1; x0 += size)
+        {
+            for (unsigned sample = 0; sample != samples; ++sample)
+            {
+                packet.clear();
+                for (unsigned y = y0; y != min(y0 + size, region.y1); ++y)
                 {
-                    // Super sampling.
-                    double xCoordinate = x + (1.0 + i) / (1.0 + supersamplingFactor);
-                    double yCoordinate = y + (1.0 + j) / (1.0 + supersamplingFactor);
-
-                    // Convert the pixels to camera space positions.
-                    double pixelX = (2.0 * xCoordinate / static_cast<double>(w) - 1.0) * aspectRatio * tan(fieldOfView / 2.0);
-                    double pixelY = (1.0 - 2.0 * yCoordinate / static_cast<double>(h)) * tan(fieldOfView / 2.0);
-
-                    // Create and rotate the pixel location.
-                    Point pixel(pixelX, pixelY, -1.0); // The camera looks along the negative z-axis, hence the -1.0.
-                    pixel.rotate(rotation);
-
-                    // Determine the focal point.
-                    Ray ray(eye, pixel.normalized());
-                    Point focalPoint = ray.O + focalLength * ray.D;
-
-                    // Shift the ray origin to simulate depth of field.
-                    Point origin(ray.O);
-                    origin.x += uniformDistribution(randomEngine) * depthOfFieldStrength;
-                    origin.y += uniformDistribution(randomEngine) * depthOfFieldStrength;
-                    ray.O = origin;
-
-                    // Recalculate the ray direction.
-                    Vector direction = (focalPoint - ray.O).normalized();
-                    ray.D = direction;
-
-                    // Trace the ray.
-                    color += trace(ray, recursionDepth).clamp();
+                    for (unsigned x = x0; x != min(x0 + size, region.x1); ++x)
+                    {
+                        unsigned idx = ((y - region.y0) * regionWidth + x - region.x0) * samples + sample;
+                        indices[packet.size] = idx;
+                        packet.add(rays[idx]);
+                    }
+                }
+
+                castPacket(packet, minHits.data(), objects.data());
+                for (unsigned lane = 0; lane != packet.size; ++lane)
+                {
+                    colors[indices[lane]] = shade(*packet.rays[lane], objects[lane], minHits[lane],
+                                                  recursionDepth).clamp();
                 }
             }
+        }
+    }
+    return colors;
+}
 
-            img(x, y) = color / (supersamplingFactor * supersamplingFactor);
+// Distance at which the primary rays through every pixel of the region can
+// start marching. All rays can skip the empty space in front of the camera
+// found by a cone around the region, narrower cones over blocks of the
+// region continue from there.
+vector<double> Scene::marchStarts(Tile const &region, unsigned w, unsigned h) const
+{
+    unsigned regionWidth = region.x1 - region.x0;
+    vector<double> starts((region.y1 - region.y0) * regionWidth, 0.0);
+    double regionStart = coneMarch(region, w, h, 0.0);
+
+    for (unsigned y = region.y0; y < region.y1; y = y - y % coneBlockSize + coneBlockSize)
+    {
+        for (unsigned x = region.x0; x < region.x1; x = x - x % coneBlockSize + coneBlockSize)
+        {
+            Tile block;
+            block.x0 = x;
+            block.y0 = y;
+            block.x1 = min(x - x % coneBlockSize + coneBlockSize, region.x1);
+            block.y1 = min(y - y % coneBlockSize + coneBlockSize, region.y1);
+            double start = coneMarch(block, w, h, regionStart);
+
+            for (unsigned by = block.y0; by != block.y1; ++by)
+                for (unsigned bx = block.x0; bx != block.x1; ++bx)
+                    starts[(by - region.y0) * regionWidth + bx - region.x0] = start;
         }
     }
+    return starts;
+}
+
+// Direction of the ray from the eye through the given image coordinates.
+Vector Scene::viewDirection(double xCoordinate, double yCoordinate, unsigned w, unsigned h) const
+{
+    // Convert the pixels to camera space positions.
+    double pixelX = (2.0 * xCoordinate / static_cast<double>(w) - 1.0) * aspectRatio * tan(fieldOfView / 2.0);
+    double pixelY = (1.0 - 2.0 * yCoordinate / static_cast<double>(h)) * tan(fieldOfView / 2.0);
+
+    // Create and rotate the pixel location.
+    Point pixel(pixelX, pixelY, -1.0); // The camera looks along the negative z-axis, hence the -1.0.
+    pixel.rotate(rotation);
+    return pixel.normalized();
+}
+
+// Marches a single cone that contains all primary rays of the tile and
+// returns the distance up to which it does not touch any ray marched object.
+// Marching starts from the result of an enclosing cone, or 0.
+double Scene::coneMarch(Tile const &tile, unsigned w, unsigned h, double start) const
+{
+    // Depth of field moves the ray origins away from the apex of the cone.
+    if (not coneMarching or depthOfFieldStrength != 0.0 or rayMarchedObjects.empty())
+        return 0.0;
+
+    Vector axis = viewDirection(0.5 * (tile.x0 + tile.x1), 0.5 * (tile.y0 + tile.y1), w, h);
+
+    // The widest angle to the axis is found at one of the corners.
+    double cosHalfAngle = 1.0;
+    cosHalfAngle = min(cosHalfAngle, axis.dot(viewDirection(tile.x0, tile.y0, w, h)));
+    cosHalfAngle = min(cosHalfAngle, axis.dot(viewDirection(tile.x1, tile.y0, w, h)));
+    cosHalfAngle = min(cosHalfAngle, axis.dot(viewDirection(tile.x0, tile.y1, w, h)));
+    cosHalfAngle = min(cosHalfAngle, axis.dot(viewDirection(tile.x1, tile.y1, w, h)));
+    double tanHalfAngle = sqrt(1.0 - cosHalfAngle * cosHalfAngle) / cosHalfAngle;
+
+    // Points of the cone closer to the eye than start are known to be empty
+    // if start came from an enclosing cone.
+    Ray axisRay(eye, axis);
+    axisRay.marchStart = start * cosHalfAngle;
+    double end = numeric_limits<double>::infinity();
+    for (RayMarchedObject *rayMarchedObj : rayMarchedObjects)
+        end = min(end, rayMarchedObj->coneMarch(axisRay, tanHalfAngle));
+
+    return end;
+}
+
+// Color of the texture of obj at the hit, averaged over the area the ray
+// covers there. The cone width of the ray is projected onto the surface and
+// converted to texture coordinates by finite differences of Object::toUV.
+Color Scene::sampleTexture(Ray const &ray, Object &obj, Point const &hit, Vector const &N,
+                           double t) const
+{
+    Texture const &texture = *obj.material.texture;
+    Vector uv = obj.toUV(hit);
+
+    // Width of the footprint on the surface, limited for grazing angles.
+    double width = ray.widthAt(t) / max(abs(N.dot(ray.D)), 0.1);
+    if (width <= 0.0)
+        return texture.sample(uv.x, uv.y, 0.0);
+
+    // Two directions in the surface.
+    Vector helper = abs(N.x) < 0.9 ? Vector(1.0, 0.0, 0.0) : Vector(0.0, 1.0, 0.0);
+    Vector tangent = N.cross(helper).normalized();
+    Vector bitangent = N.cross(tangent);
+
+    // Texture coordinates repeat, so differences across the seam are wrapped.
+    double footprint = 0.0;
+    for (Vector const &direction : { tangent, bitangent })
+    {
+        Vector uvStep = obj.toUV(hit + width * direction);
+        double du = uvStep.x - uv.x;
+        double dv = uvStep.y - uv.y;
+        du -= round(du);
+        dv -= round(dv);
+        footprint = max(footprint, sqrt(du * du + dv * dv));
+    }
+
+    return texture.sample(uv.x, uv.y, footprint);
+}
+
+// A secondary ray from a hit at distance t of ray, continuing its cone.
+Ray Scene::spawnRay(Ray const &ray, double t, Point const &origin, Vector const &direction) const
+{
+    Ray spawned(origin, direction);
+    spawned.width = ray.widthAt(t);
+    spawned.spread = ray.spread;
+    return spawned;
 }
 
 Color Scene::sampleBackground(Ray const &ray, unsigned depth) const
@@ -241,6 +845,9 @@ Color Scene::sampleBackground(Ray const &ray, unsigned depth) const
 Scene::Scene()
 :
     objects(),
+    bvh(),
+    unboundedObjects(),
+    rayMarchedObjects(),
     lights(),
     eye(),
     rotation(),
@@ -250,7 +857,15 @@ Scene::Scene()
     supersamplingFactor(1),
     backgroundColor(),
     depthOfFieldStrength(0.0),
-    focalLength(1.0)
+    focalLength(1.0),
+    threadCount(0),
+    tileSize(32),
+    hasSeed(false),
+    seed(0),
+    coneMarching(true),
+    packetSize(4),
+    adaptiveSampling(false),
+    adaptiveThreshold(0.1)
 {}
 
 void Scene::addObject(ObjectPtr obj)
@@ -283,6 +898,16 @@ unsigned Scene::getNumObject()
     return objects.size();
 }
 
+vector<ObjectPtr> const &Scene::getObjects() const
+{
+    return objects;
+}
+
+Statistics const &Scene::getStatistics() const
+{
+    return renderStatistics;
+}
+
 unsigned Scene::getNumLights()
 {
     return lights.size();
@@ -303,6 +928,21 @@ void Scene::setSuperSample(unsigned factor)
     supersamplingFactor = factor;
 }
 
+unsigned Scene::getSuperSample() const
+{
+    return supersamplingFactor;
+}
+
+void Scene::setAdaptiveSampling(bool enabled)
+{
+    adaptiveSampling = enabled;
+}
+
+void Scene::setAdaptiveThreshold(double threshold)
+{
+    adaptiveThreshold = threshold;
+}
+
 void Scene::setBackgroundColor(Triple const &color)
 {
     backgroundColor = color;
@@ -317,3 +957,44 @@ void Scene::setFocalLength(double length)
 {
     focalLength = length;
 }
+
+void Scene::setThreadCount(unsigned count)
+{
+    threadCount = count;
+}
+
+unsigned Scene::getThreadCount() const
+{
+    return threadCount;
+}
+
+void Scene::setTileSize(unsigned size)
+{
+    tileSize = size;
+}
+
+unsigned Scene::getTileSize() const
+{
+    return tileSize;
+}
+
+void Scene::setSeed(unsigned seed)
+{
+    hasSeed = true;
+    this->seed = seed;
+}
+
+void Scene::setConeMarching(bool enabled)
+{
+    coneMarching = enabled;
+}
+
+void Scene::setPacketSize(unsigned size)
+{
+    packetSize = size;
+}
+
+unsigned Scene::getPacketSize() const
+{
+    return packetSize;
+}
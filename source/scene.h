@@ -1,20 +1,36 @@
 #ifndef SCENE_H_
 #define SCENE_H_
 
+#include "bvh.h"
+#include "heatmap.h"
 #include "light.h"
 #include "object.h"
+#include "primitive_arrays.h"
+#include "statistics.h"
 #include "triple.h"
 
+#include <chrono>
+#include <functional>
+#include <random>
 #include <vector>
 #include <utility>
 
 // Forward declarations
 class Ray;
-class Image;
+class RayPacket;
+class Framebuffer;
+class Checkpoint;
+class TileScheduler;
+class RayMarchedObject;
+struct Tile;
 
 class Scene
 {
     std::vector<ObjectPtr> objects;
+    PrimitiveArrays primitives;                 // spheres and quads, if only a few
+    BVH bvh;                                    // other objects with finite bounds
+    std::vector<ObjectPtr> unboundedObjects;    // tested for every ray
+    std::vector<RayMarchedObject*> rayMarchedObjects;   // subset of objects, for cone marching
     std::vector<LightPtr> lights;
     Point eye;
     Vector rotation;
@@ -26,6 +42,16 @@ class Scene
     Color backgroundColor;
     double depthOfFieldStrength;
     double focalLength;
+    unsigned threadCount;
+    unsigned tileSize;
+    bool hasSeed;
+    unsigned seed;
+    bool coneMarching;
+    unsigned packetSize;            // packets of primary rays, in pixels per side
+    bool adaptiveSampling;
+    double adaptiveThreshold;       // contrast between neighbours that is refined
+    Statistics renderStatistics;    // of the last render, if enabled
+    std::vector<std::vector<double>> passStarts;    // march starts per tile, kept across passes
 
     // Offset multiplier. Before casting a new ray from a hit point,
     // move the hit point in the direction of the normal with this offset
@@ -36,14 +62,53 @@ class Scene
     public:
         Scene();
 
+        // build the acceleration structure, must be called after all objects are added
+        void buildAccelerationStructure();
+
         // determine closest hit (if any)
         std::pair<ObjectPtr, Hit> castRay(Ray const &ray) const;
 
+        // castRay for every ray of the packet, the closest hit of a lane is
+        // returned in minHits[lane] and objects[lane]
+        void castPacket(RayPacket const &packet, Hit *minHits, ObjectPtr *objects) const;
+
+        // determine whether anything is hit before maxT (shadow rays)
+        bool occluded(Ray const &ray, double maxT) const;
+
         // trace a ray into the scene and return the color
         Color trace(Ray const &ray, unsigned depth);
 
-        // render the scene to the given image
-        void render(Image &img);
+        // the color of a ray whose closest hit (if any) is known
+        Color shade(Ray const &ray, ObjectPtr const &obj, Hit const &min_hit, unsigned depth);
+
+        // render the scene to the given image, and optionally record the
+        // cost of every pixel in the heatmap (of the same size), resume
+        // from and save to the checkpoint and call finished for every tile
+        // once it is done (or restored from the checkpoint), from the thread
+        // that rendered it
+        void render(Framebuffer &img, Heatmap *heatmap = nullptr, Checkpoint *checkpoint = nullptr,
+                    std::function<void(Tile const &)> const &finished = nullptr);
+
+        // progressive rendering: add one more sample to every pixel of the
+        // w x h image (the pass-th of the sequence) to sum and increment its
+        // count. Rows that have not started by the deadline are skipped.
+        void renderPass(std::vector<Color> &sum, std::vector<unsigned> &counts,
+                        unsigned w, unsigned h, unsigned pass,
+                        std::chrono::steady_clock::time_point deadline,
+                        Heatmap *heatmap = nullptr);
+
+        // render only the tiles with the given indices (in the tiling of
+        // the w x h image by the tile size) with the given seed. Every tile
+        // is rendered into a buffer of its own (and, with a heatmap, its
+        // costs in the metric into a heatmap of its own), which finished
+        // gets once the tile is done, from the thread that rendered it
+        void renderTiles(unsigned w, unsigned h, std::vector<unsigned> const &indices,
+                         unsigned baseSeed, bool heatmap, Heatmap::Metric metric,
+                         std::function<void(Tile const &, Framebuffer const &,
+                                            Heatmap const *)> const &finished);
+
+        // the fixed seed, or a new random one if no seed is set
+        unsigned renderSeed() const;
 
         void addObject(ObjectPtr obj);
         void addLight(Light const &light);
@@ -53,15 +118,44 @@ class Scene
         void setRenderShadows(bool renderShadows);
         void setRecursionDepth(unsigned depth);
         void setSuperSample(unsigned factor);
+        unsigned getSuperSample() const;
+        void setAdaptiveSampling(bool enabled);
+        void setAdaptiveThreshold(double threshold);
         void setBackgroundColor(Triple const &color);
         void setDepthOfFieldStrength(double strength);
         void setFocalLength(double length);
+        void setThreadCount(unsigned count);
+        unsigned getThreadCount() const;
+        void setTileSize(unsigned size);
+        unsigned getTileSize() const;
+        void setSeed(unsigned seed);
+        void setConeMarching(bool enabled);
+        void setPacketSize(unsigned size);     // 1 traces every ray alone
+        unsigned getPacketSize() const;
 
         unsigned getNumObject();
+        std::vector<ObjectPtr> const &getObjects() const;
+        Statistics const &getStatistics() const;
         unsigned getNumLights();
 
     private:
+        void forEachTile(TileScheduler const &scheduler,
+                         std::function<void(Tile const &)> const &renderTile);
+        void renderTile(Framebuffer &img, Tile const &tile, unsigned w, unsigned h, unsigned x0,
+                        unsigned y0, std::default_random_engine &randomEngine, Heatmap *heatmap);
+        Color samplePixel(double xCoordinate, double yCoordinate, unsigned w, unsigned h,
+                          double marchStart, std::default_random_engine &randomEngine);
+        Ray primaryRay(double xCoordinate, double yCoordinate, unsigned w, unsigned h,
+                       double marchStart, std::default_random_engine &randomEngine) const;
+        std::vector<Color> tracePackets(std::vector<Ray> const &rays, Tile const &region,
+                                        unsigned samples);
+        std::vector<double> marchStarts(Tile const &region, unsigned w, unsigned h) const;
+        Vector viewDirection(double xCoordinate, double yCoordinate, unsigned w, unsigned h) const;
+        double coneMarch(Tile const &tile, unsigned w, unsigned h, double start) const;
         Color sampleBackground(Ray const &ray, unsigned depth) const;
+        Color sampleTexture(Ray const &ray, Object &obj, Point const &hit, Vector const &N,
+                            double t) const;
+        Ray spawnRay(Ray const &ray, double t, Point const &origin, Vector const &direction) const;
 };
 
 #endif
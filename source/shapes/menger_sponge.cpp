@@ -1,10 +1,72 @@
 #include "menger_sponge.h"
 
+#include "../simd.h"
+
 #include <cmath>
 #include <limits>
 
 using namespace std;
 
+#ifdef SIMD_X86
+namespace
+{
+    // GLSL style floating point modulo by 2, minus 1, and the distance to
+    // the cross of that period, see MengerSponge::distanceEstimator.
+    __attribute__((target("avx2")))
+    inline __m256d foldAvx2(__m256d value)
+    {
+        __m256d const one = _mm256_set1_pd(1.0);
+        __m256d const two = _mm256_set1_pd(2.0);
+        value = _mm256_sub_pd(value, _mm256_mul_pd(two, _mm256_floor_pd(_mm256_div_pd(value, two))));
+        value = _mm256_sub_pd(value, one);
+        return absAvx2(_mm256_sub_pd(one, _mm256_mul_pd(_mm256_set1_pd(3.0), absAvx2(value))));
+    }
+
+    // MengerSponge::distanceEstimator for 4 positions, with the same
+    // operations in the same order.
+    __attribute__((target("avx2")))
+    void distanceEstimatorAvx2(double const *px, double const *py, double const *pz,
+                               double *distances, size_t iterations)
+    {
+        __m256d const zero = _mm256_setzero_pd();
+        __m256d const one = _mm256_set1_pd(1.0);
+        __m256d const three = _mm256_set1_pd(3.0);
+        __m256d x = _mm256_loadu_pd(px);
+        __m256d y = _mm256_loadu_pd(py);
+        __m256d z = _mm256_loadu_pd(pz);
+
+        // The unit box, see MengerSponge::box.
+        __m256d bx = _mm256_sub_pd(absAvx2(x), one);
+        __m256d by = _mm256_sub_pd(absAvx2(y), one);
+        __m256d bz = _mm256_sub_pd(absAvx2(z), one);
+        __m256d inside = minAvx2(maxAvx2(bx, maxAvx2(by, bz)), zero);
+        bx = maxAvx2(bx, zero);
+        by = maxAvx2(by, zero);
+        bz = maxAvx2(bz, zero);
+        __m256d d = _mm256_add_pd(_mm256_sqrt_pd(length2Avx2(bx, by, bz)), inside);
+
+        __m256d scale = one;
+        for (size_t iteration = 0; iteration < iterations; ++iteration)
+        {
+            __m256d rx = foldAvx2(_mm256_mul_pd(x, scale));
+            __m256d ry = foldAvx2(_mm256_mul_pd(y, scale));
+            __m256d rz = foldAvx2(_mm256_mul_pd(z, scale));
+
+            scale = _mm256_mul_pd(scale, three);
+
+            __m256d da = maxAvx2(rx, ry);
+            __m256d db = maxAvx2(ry, rz);
+            __m256d dc = maxAvx2(rz, rx);
+            __m256d c = _mm256_div_pd(_mm256_sub_pd(minAvx2(da, minAvx2(db, dc)), one), scale);
+
+            d = maxAvx2(d, c);
+        }
+
+        _mm256_storeu_pd(distances, d);
+    }
+}
+#endif
+
 MengerSponge::MengerSponge(size_t iterations)
 :
     iterations(iterations)
@@ -50,6 +112,24 @@ double MengerSponge::distanceEstimator(Point const &position)
     return d;
 }
 
+void MengerSponge::batchDistanceEstimator(size_t count, double const *x, double const *y,
+                                          double const *z, double *distances)
+{
+#ifdef SIMD_X86
+    if (useAvx2())
+    {
+        forEachBlockOf4(count, x, y, z, distances, [&](double const *blockX, double const *blockY,
+                                                       double const *blockZ, double *blockDistances)
+        {
+            distanceEstimatorAvx2(blockX, blockY, blockZ, blockDistances, iterations);
+        });
+        return;
+    }
+#endif
+
+    RayMarchedObject::batchDistanceEstimator(count, x, y, z, distances);
+}
+
 double MengerSponge::box(Point const &position, Point const &b)
 {
     Point adjusted = position;
@@ -64,3 +144,11 @@ double MengerSponge::box(Point const &position, Point const &b)
     adjusted.z = max(adjusted.z, 0.0);
     return adjusted.length() + m;
 }
+
+bool MengerSponge::boundingSphere(Point &center, double &radius)
+{
+    // Sphere around the unit box the holes are cut from.
+    center = Point(0.0, 0.0, 0.0);
+    radius = sqrt(3.0);
+    return true;
+}
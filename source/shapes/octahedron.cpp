@@ -1,10 +1,57 @@
 #include "octahedron.h"
 
+#include "../simd.h"
+
 #include <algorithm>
 #include <cmath>
 
 using namespace std;
 
+#ifdef SIMD_X86
+namespace
+{
+    // Octahedron::distanceEstimator for 4 positions. Every lane takes its
+    // branch of the scalar version through blends, with the same results.
+    __attribute__((target("avx2")))
+    void distanceEstimatorAvx2(double const *px, double const *py, double const *pz,
+                               double *distances)
+    {
+        __m256d const zero = _mm256_setzero_pd();
+        __m256d const one = _mm256_set1_pd(1.0);
+        __m256d const three = _mm256_set1_pd(3.0);
+        __m256d x = absAvx2(_mm256_loadu_pd(px));
+        __m256d y = absAvx2(_mm256_loadu_pd(py));
+        __m256d z = absAvx2(_mm256_loadu_pd(pz));
+
+        __m256d m = _mm256_sub_pd(_mm256_add_pd(_mm256_add_pd(x, y), z), one);
+        __m256d caseX = _mm256_cmp_pd(_mm256_mul_pd(three, x), m, _CMP_LT_OQ);
+        __m256d caseY = _mm256_andnot_pd(caseX, _mm256_cmp_pd(_mm256_mul_pd(three, y), m, _CMP_LT_OQ));
+        __m256d caseZ = _mm256_andnot_pd(_mm256_or_pd(caseX, caseY),
+                                         _mm256_cmp_pd(_mm256_mul_pd(three, z), m, _CMP_LT_OQ));
+        __m256d face = _mm256_andnot_pd(_mm256_or_pd(caseX, _mm256_or_pd(caseY, caseZ)),
+                                        _mm256_castsi256_pd(_mm256_set1_epi64x(-1)));
+
+        // The coordinates permuted by the case, the third case by default.
+        __m256d qx = _mm256_blendv_pd(_mm256_blendv_pd(z, y, caseY), x, caseX);
+        __m256d qy = _mm256_blendv_pd(_mm256_blendv_pd(x, z, caseY), y, caseX);
+        __m256d qz = _mm256_blendv_pd(_mm256_blendv_pd(y, x, caseY), z, caseX);
+
+        // std::clamp(0.5 * (qz - qy + 1.0), 0.0, 1.0)
+        __m256d k = _mm256_mul_pd(_mm256_set1_pd(0.5), _mm256_add_pd(_mm256_sub_pd(qz, qy), one));
+        __m256d clamped = _mm256_blendv_pd(k, one, _mm256_cmp_pd(one, k, _CMP_LT_OQ));
+        k = _mm256_blendv_pd(clamped, zero, _mm256_cmp_pd(k, zero, _CMP_LT_OQ));
+
+        __m256d ex = qx;
+        __m256d ey = _mm256_add_pd(_mm256_sub_pd(qy, one), k);
+        __m256d ez = _mm256_sub_pd(qz, k);
+        __m256d edge = _mm256_sqrt_pd(length2Avx2(ex, ey, ez));
+
+        __m256d distance = _mm256_blendv_pd(edge, _mm256_mul_pd(m, _mm256_set1_pd(0.57735027)), face);
+        _mm256_storeu_pd(distances, distance);
+    }
+}
+#endif
+
 double Octahedron::distanceEstimator(Point const &position)
 {
     Point adjusted(position);
@@ -39,3 +86,74 @@ double Octahedron::distanceEstimator(Point const &position)
     double k = clamp(0.5 * (q.z - q.y + 1.0), 0.0 , 1.0);
     return Point{q.x, q.y - 1.0 + k, q.z - k}.length();
 }
+
+void Octahedron::batchDistanceEstimator(size_t count, double const *x, double const *y,
+                                       double const *z, double *distances)
+{
+#ifdef SIMD_X86
+    if (useAvx2())
+    {
+        forEachBlockOf4(count, x, y, z, distances, [&](double const *blockX, double const *blockY,
+                                                       double const *blockZ, double *blockDistances)
+        {
+            distanceEstimatorAvx2(blockX, blockY, blockZ, blockDistances);
+        });
+        return;
+    }
+#endif
+
+    RayMarchedObject::batchDistanceEstimator(count, x, y, z, distances);
+}
+
+bool Octahedron::gradient(Point const &position, Vector &gradient)
+{
+    // Mirror of the distance estimator, see distanceEstimator.
+    Point adjusted(position);
+    adjusted.x = abs(adjusted.x);
+    adjusted.y = abs(adjusted.y);
+    adjusted.z = abs(adjusted.z);
+
+    double m = adjusted.x + adjusted.y + adjusted.z - 1.0;
+    Vector absGradient;
+
+    if (3.0 * adjusted.x < m or 3.0 * adjusted.y < m or 3.0 * adjusted.z < m)
+    {
+        // Gradient of the distance to the closest edge, in the permuted coordinates.
+        Point q;
+        if (3.0 * adjusted.x < m)
+            q = adjusted;
+        else if (3.0 * adjusted.y < m)
+            q = Point{adjusted.y, adjusted.z, adjusted.x};
+        else
+            q = Point{adjusted.z, adjusted.x, adjusted.y};
+
+        double k = clamp(0.5 * (q.z - q.y + 1.0), 0.0 , 1.0);
+        Vector qGradient{q.x, q.y - 1.0 + k, q.z - k};
+
+        // Undo the permutation.
+        if (3.0 * adjusted.x < m)
+            absGradient = qGradient;
+        else if (3.0 * adjusted.y < m)
+            absGradient = Vector{qGradient.z, qGradient.x, qGradient.y};
+        else
+            absGradient = Vector{qGradient.y, qGradient.z, qGradient.x};
+    }
+    else
+    {
+        // Closest to a face, the plane x + y + z = 1.
+        absGradient = Vector{1.0, 1.0, 1.0};
+    }
+
+    // Undo the mirroring into the positive octant.
+    gradient.x = position.x < 0.0 ? -absGradient.x : absGradient.x;
+    gradient.y = position.y < 0.0 ? -absGradient.y : absGradient.y;
+    gradient.z = position.z < 0.0 ? -absGradient.z : absGradient.z;
+    return true;
+}
+
+bool Octahedron::boundingSphere(Point &center, double &radius)
+{
+    center = Point(0.0, 0.0, 0.0);
+    radius = 1.0;
+    return true;
+}
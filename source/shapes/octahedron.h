@@ -7,6 +7,10 @@ class Octahedron : public RayMarchedObject
 {
 public:
     double distanceEstimator(Point const &position) override;
+    void batchDistanceEstimator(size_t count, double const *x, double const *y, double const *z,
+                                double *distances) override;
+    bool boundingSphere(Point &center, double &radius) override;
+    bool gradient(Point const &position, Vector &gradient) override;
 };
 
 #endif
@@ -32,6 +32,16 @@ Hit Quad::intersect(Ray const &ray)
     return Hit::NO_HIT();
 }
 
+BoundingBox Quad::bounds()
+{
+    BoundingBox box;
+    box.extend(v0);
+    box.extend(v1);
+    box.extend(v2);
+    box.extend(v3);
+    return box;
+}
+
 Vector Quad::toUV(Point const &hit)
 {
     double u = (hit - v0).dot(v1 - v0) / (v1 - v0).length_2();
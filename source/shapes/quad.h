@@ -12,6 +12,7 @@ class Quad: public Object
              Point const &v3);
 
         Hit intersect(Ray const &ray) override;
+        BoundingBox bounds() override;
         Vector toUV(Point const &hit) override;
 
         Point const v0;
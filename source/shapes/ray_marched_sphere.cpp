@@ -6,3 +6,16 @@ double RayMarchedSphere::distanceEstimator(Point const &position)
 {
     return position.length() - 1.0; // Default radius is 1, this can be changed using a scale operation.
 }
+
+bool RayMarchedSphere::gradient(Point const &position, Vector &gradient)
+{
+    gradient = position;
+    return true;
+}
+
+bool RayMarchedSphere::boundingSphere(Point &center, double &radius)
+{
+    center = Point(0.0, 0.0, 0.0);
+    radius = 1.0;
+    return true;
+}
@@ -7,6 +7,8 @@ class RayMarchedSphere: public RayMarchedObject
 {
     public:
         double distanceEstimator(Point const &position) override;
+        bool boundingSphere(Point &center, double &radius) override;
+        bool gradient(Point const &position, Vector &gradient) override;
 };
 
 #endif
@@ -1,10 +1,68 @@
 #include "sierpinski_tetrahedron.h"
 
+#include "../simd.h"
+
 #include <cmath>
 #include <iostream>
 
 using namespace std;
 
+#ifdef SIMD_X86
+namespace
+{
+    // SierpinskiTetrahedron::distanceEstimator for 4 positions, with the
+    // same operations in the same order. scale is 2 to the power of minus
+    // the number of iterations.
+    __attribute__((target("avx2")))
+    void distanceEstimatorAvx2(double const *px, double const *py, double const *pz,
+                               double *distances, size_t iterations, double scale)
+    {
+        __m256d const two = _mm256_set1_pd(2.0);
+        double const vertices[4][3] = {{ 1.0,  1.0,  1.0},
+                                       {-1.0, -1.0,  1.0},
+                                       { 1.0, -1.0, -1.0},
+                                       {-1.0,  1.0, -1.0}};
+
+        __m256d x = _mm256_loadu_pd(px);
+        __m256d y = _mm256_loadu_pd(py);
+        __m256d z = _mm256_loadu_pd(pz);
+        for (size_t index = 0; index < iterations; ++index)
+        {
+            __m256d closestX = _mm256_set1_pd(vertices[0][0]);
+            __m256d closestY = _mm256_set1_pd(vertices[0][1]);
+            __m256d closestZ = _mm256_set1_pd(vertices[0][2]);
+            __m256d closestDistance = _mm256_sqrt_pd(length2Avx2(_mm256_sub_pd(x, closestX),
+                                                                 _mm256_sub_pd(y, closestY),
+                                                                 _mm256_sub_pd(z, closestZ)));
+
+            for (unsigned vertex = 1; vertex != 4; ++vertex)
+            {
+                __m256d vertexX = _mm256_set1_pd(vertices[vertex][0]);
+                __m256d vertexY = _mm256_set1_pd(vertices[vertex][1]);
+                __m256d vertexZ = _mm256_set1_pd(vertices[vertex][2]);
+                __m256d distance = _mm256_sqrt_pd(length2Avx2(_mm256_sub_pd(x, vertexX),
+                                                              _mm256_sub_pd(y, vertexY),
+                                                              _mm256_sub_pd(z, vertexZ)));
+
+                __m256d closer = _mm256_cmp_pd(distance, closestDistance, _CMP_LT_OQ);
+                closestX = _mm256_blendv_pd(closestX, vertexX, closer);
+                closestY = _mm256_blendv_pd(closestY, vertexY, closer);
+                closestZ = _mm256_blendv_pd(closestZ, vertexZ, closer);
+                closestDistance = _mm256_blendv_pd(closestDistance, distance, closer);
+            }
+
+            // adjusted = 2 adjusted - closest * (2 - 1)
+            x = _mm256_sub_pd(_mm256_mul_pd(two, x), closestX);
+            y = _mm256_sub_pd(_mm256_mul_pd(two, y), closestY);
+            z = _mm256_sub_pd(_mm256_mul_pd(two, z), closestZ);
+        }
+
+        __m256d length = _mm256_sqrt_pd(length2Avx2(x, y, z));
+        _mm256_storeu_pd(distances, _mm256_mul_pd(length, _mm256_set1_pd(scale)));
+    }
+}
+#endif
+
 SierpinskiTetrahedron::SierpinskiTetrahedron(size_t iterations)
 :
     iterations(iterations)
@@ -53,3 +111,30 @@ double SierpinskiTetrahedron::distanceEstimator(Point const &position)
 
     return adjusted.length() * pow(2.0, -static_cast<double>(iterations));
 }
+
+void SierpinskiTetrahedron::batchDistanceEstimator(size_t count, double const *x, double const *y,
+                                                  double const *z, double *distances)
+{
+#ifdef SIMD_X86
+    if (useAvx2())
+    {
+        double scale = pow(2.0, -static_cast<double>(iterations));
+        forEachBlockOf4(count, x, y, z, distances, [&](double const *blockX, double const *blockY,
+                                                       double const *blockZ, double *blockDistances)
+        {
+            distanceEstimatorAvx2(blockX, blockY, blockZ, blockDistances, iterations, scale);
+        });
+        return;
+    }
+#endif
+
+    RayMarchedObject::batchDistanceEstimator(count, x, y, z, distances);
+}
+
+bool SierpinskiTetrahedron::boundingSphere(Point &center, double &radius)
+{
+    // Sphere through the vertices of the tetrahedron.
+    center = Point(0.0, 0.0, 0.0);
+    radius = sqrt(3.0);
+    return true;
+}
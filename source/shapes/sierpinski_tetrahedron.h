@@ -9,6 +9,9 @@ class SierpinskiTetrahedron: public RayMarchedObject
         SierpinskiTetrahedron(size_t iterations);
 
         double distanceEstimator(Point const &position) override;
+        void batchDistanceEstimator(size_t count, double const *x, double const *y,
+                                    double const *z, double *distances) override;
+        bool boundingSphere(Point &center, double &radius) override;
 
         size_t const iterations;
 };
@@ -1,6 +1,7 @@
 #include "sphere.h"
 #include "solvers.h"
 
+#include <algorithm>
 #include <cmath>
 
 using namespace std;
@@ -38,11 +39,40 @@ Hit Sphere::intersect(Ray const &ray)
     return Hit(t0, N);
 }
 
+bool Sphere::occludes(Ray const &ray, double maxT)
+{
+    Vector L = ray.O - position;
+    double a = ray.D.dot(ray.D);
+    double b = 2.0 * ray.D.dot(L);
+    double c = L.dot(L) - r * r;
+
+    double t0;
+    double t1;
+    if (not Solvers::quadratic(a, b, c, t0, t1))
+        return false;
+
+    // Either intersection in front of the ray origin and before maxT blocks it.
+    return (t0 >= 0.0 and t0 < maxT) or (t1 >= 0.0 and t1 < maxT);
+}
+
+BoundingBox Sphere::bounds()
+{
+    return BoundingBox(position - r, position + r);
+}
+
 Vector Sphere::toUV(Point const &hit)
 {
-    // placeholders
-    double u = 0.0;
-    double v = 0.0;
+    // Spherical coordinates around the axis: u runs along the equator,
+    // starting at the given angle (in degrees), v from the north pole.
+    Vector up = axis.normalized();
+    Vector helper = abs(up.x) < 0.9 ? Vector(1.0, 0.0, 0.0) : Vector(0.0, 1.0, 0.0);
+    Vector east = up.cross(helper).normalized();
+    Vector north = up.cross(east);
+
+    Vector P = (hit - position).normalized();
+    double u = atan2(P.dot(north), P.dot(east)) / (2.0 * PI) + angle / 360.0;
+    u -= floor(u);
+    double v = acos(max(-1.0, min(1.0, P.dot(up)))) / PI;
 
     // Use a Vector to return 2 doubles. The third value is never read.
     return Vector{u, v, 0.0};
@@ -12,6 +12,8 @@ class Sphere: public Object
                Vector const& axis = Vector(0.0, 1.0, 0.0), double angle = 0.0);
 
         Hit intersect(Ray const &ray) override;
+        bool occludes(Ray const &ray, double maxT) override;
+        BoundingBox bounds() override;
         Vector toUV(Point const &hit) override;
 
         Point const position;
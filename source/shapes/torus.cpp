@@ -1,9 +1,33 @@
 #include "torus.h"
 
+#include "../simd.h"
+
 #include <cmath>
 
 using namespace std;
 
+#ifdef SIMD_X86
+namespace
+{
+    // Torus::distanceEstimator for 4 positions.
+    __attribute__((target("avx2")))
+    void distanceEstimatorAvx2(double const *px, double const *py, double const *pz,
+                               double *distances, double height, double width)
+    {
+        __m256d x = _mm256_loadu_pd(px);
+        __m256d y = _mm256_loadu_pd(py);
+        __m256d z = _mm256_loadu_pd(pz);
+
+        __m256d radial = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(x, x), _mm256_mul_pd(z, z)));
+        __m256d val1 = _mm256_sub_pd(radial, _mm256_set1_pd(width));
+        __m256d val2 = y;
+        __m256d distance = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(val1, val1),
+                                                        _mm256_mul_pd(val2, val2)));
+        _mm256_storeu_pd(distances, _mm256_sub_pd(distance, _mm256_set1_pd(height)));
+    }
+}
+#endif
+
 Torus::Torus(double height, double width)
 :
     height(height),
@@ -17,3 +41,43 @@ double Torus::distanceEstimator(Point const &position)
     double val2 = adjusted.y;
     return sqrt(val1 * val1 + val2 * val2) - height;
 }
+
+void Torus::batchDistanceEstimator(size_t count, double const *x, double const *y,
+                                  double const *z, double *distances)
+{
+#ifdef SIMD_X86
+    if (useAvx2())
+    {
+        forEachBlockOf4(count, x, y, z, distances, [&](double const *blockX, double const *blockY,
+                                                       double const *blockZ, double *blockDistances)
+        {
+            distanceEstimatorAvx2(blockX, blockY, blockZ, blockDistances, height, width);
+        });
+        return;
+    }
+#endif
+
+    RayMarchedObject::batchDistanceEstimator(count, x, y, z, distances);
+}
+
+bool Torus::gradient(Point const &position, Vector &gradient)
+{
+    // Chain rule through the distance to the circle in the xz-plane.
+    double radial = sqrt(position.x * position.x + position.z * position.z);
+    double val1 = radial - width;
+    double val2 = position.y;
+    if (radial == 0.0)
+        return false;
+
+    gradient.x = val1 * position.x / radial;
+    gradient.y = val2;
+    gradient.z = val1 * position.z / radial;
+    return true;
+}
+
+bool Torus::boundingSphere(Point &center, double &radius)
+{
+    center = Point(0.0, 0.0, 0.0);
+    radius = width + height;
+    return true;
+}
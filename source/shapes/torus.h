@@ -9,6 +9,10 @@ class Torus: public RayMarchedObject
         Torus(double height, double width);
 
         double distanceEstimator(Point const &position) override;
+        void batchDistanceEstimator(size_t count, double const *x, double const *y,
+                                    double const *z, double *distances) override;
+        bool boundingSphere(Point &center, double &radius) override;
+        bool gradient(Point const &position, Vector &gradient) override;
 
         double const height;
         double const width;
@@ -0,0 +1,85 @@
+#ifndef SIMD_H_
+#define SIMD_H_
+
+#include <algorithm>
+#include <cstddef>
+
+// Hand written SIMD code is compiled for x86 with GCC or Clang, as functions
+// targeting the instruction set they use (__attribute__((target("avx2"))))
+// in an otherwise baseline build. Whether they run is decided at runtime,
+// see PrimitiveArrays::kernel.
+#if defined(__GNUG__) and (defined(__x86_64__) or defined(__i386__))
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+#ifdef SIMD_X86
+
+// The results of std::max(a, b) and std::min(a, b) for every lane, also
+// for signed zeros and NaN.
+__attribute__((target("avx2")))
+inline __m256d maxAvx2(__m256d a, __m256d b)
+{
+    return _mm256_max_pd(b, a);
+}
+
+__attribute__((target("avx2")))
+inline __m256d minAvx2(__m256d a, __m256d b)
+{
+    return _mm256_min_pd(b, a);
+}
+
+__attribute__((target("avx2")))
+inline __m256d absAvx2(__m256d value)
+{
+    return _mm256_andnot_pd(_mm256_set1_pd(-0.0), value);
+}
+
+// Loads two values, or one and a zero at the end of a range.
+__attribute__((target("sse4.1")))
+inline __m128d load2(double const *values, bool pair)
+{
+    return pair ? _mm_loadu_pd(values) : _mm_load_sd(values);
+}
+
+// Triple::length_2 for every lane.
+__attribute__((target("avx2")))
+inline __m256d length2Avx2(__m256d x, __m256d y, __m256d z)
+{
+    return _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(x, x), _mm256_mul_pd(y, y)),
+                         _mm256_mul_pd(z, z));
+}
+
+#endif
+
+// Calls block(x, y, z, results) for every 4 consecutive elements of the
+// count positions and results. A last partial block is padded by repeating
+// its last position, so block always gets 4 of them.
+template <typename Block>
+void forEachBlockOf4(size_t count, double const *x, double const *y, double const *z,
+                     double *results, Block const &block)
+{
+    size_t idx = 0;
+    for (; idx + 4 <= count; idx += 4)
+        block(x + idx, y + idx, z + idx, results + idx);
+
+    if (idx == count)
+        return;
+
+    double paddedX[4];
+    double paddedY[4];
+    double paddedZ[4];
+    double paddedResults[4];
+    for (size_t lane = 0; lane != 4; ++lane)
+    {
+        size_t source = std::min(idx + lane, count - 1);
+        paddedX[lane] = x[source];
+        paddedY[lane] = y[source];
+        paddedZ[lane] = z[source];
+    }
+
+    block(paddedX, paddedY, paddedZ, paddedResults);
+    std::copy(paddedResults, paddedResults + (count - idx), results + idx);
+}
+
+#endif
@@ -0,0 +1,124 @@
+#include "statistics.h"
+
+#include "object.h"
+
+#include "json/json.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+
+#ifdef __GNUG__
+#include <cxxabi.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+    // Readable name of a type, e.g. Mandelbulb instead of 10Mandelbulb.
+    string typeName(type_index const &type)
+    {
+#ifdef __GNUG__
+        int status;
+        unique_ptr<char, void (*)(void *)> name(abi::__cxa_demangle(type.name(), nullptr, nullptr, &status),
+                                                free);
+        if (status == 0)
+            return name.get();
+#endif
+        return type.name();
+    }
+
+    // Intersection tests ordered by type name, for stable output.
+    map<string, uint64_t> namedIntersectionTests(Statistics const &statistics)
+    {
+        map<string, uint64_t> tests;
+        for (auto const &entry : statistics.intersectionTests)
+            tests[typeName(entry.first)] += entry.second;
+        return tests;
+    }
+}
+
+void Statistics::add(Statistics const &other)
+{
+    primaryRays += other.primaryRays;
+    secondaryRays += other.secondaryRays;
+    shadowRays += other.shadowRays;
+    marchSteps += other.marchSteps;
+    coneMarchSteps += other.coneMarchSteps;
+    maxStepsExits += other.maxStepsExits;
+    refinedPixels += other.refinedPixels;
+
+    for (unsigned level = 0; level != depthLevels; ++level)
+        depthHistogram[level] += other.depthHistogram[level];
+
+    for (auto const &entry : other.intersectionTests)
+        intersectionTests[entry.first] += entry.second;
+}
+
+void Statistics::countIntersectionTest(Object const &object)
+{
+    ++intersectionTests[type_index(typeid(object))];
+}
+
+nlohmann::json Statistics::toJson() const
+{
+    nlohmann::json node;
+    node["primaryRays"] = primaryRays;
+    node["secondaryRays"] = secondaryRays;
+    node["shadowRays"] = shadowRays;
+    node["marchSteps"] = marchSteps;
+    node["coneMarchSteps"] = coneMarchSteps;
+    node["maxStepsExits"] = maxStepsExits;
+    node["refinedPixels"] = refinedPixels;
+    node["depthHistogram"] = vector<uint64_t>(depthHistogram, depthHistogram + depthLevels);
+    node["intersectionTests"] = namedIntersectionTests(*this);
+    return node;
+}
+
+void Statistics::print(ostream &out) const
+{
+    uint64_t rays = primaryRays + secondaryRays + shadowRays;
+
+    out << "Rays: " << primaryRays << " primary, " << secondaryRays << " secondary, "
+        << shadowRays << " shadow.\n";
+
+    out << "March steps: " << marchSteps;
+    if (rays > 0)
+        out << " (" << static_cast<double>(marchSteps) / rays << " per ray)";
+    out << ", " << maxStepsExits << " marches ran out of steps.\n";
+
+    if (coneMarchSteps > 0)
+        out << "Cone march steps: " << coneMarchSteps << ".\n";
+
+    if (refinedPixels > 0)
+        out << "Adaptive sampling refined " << refinedPixels << " pixels.\n";
+
+    // Leave out the empty levels at the end.
+    unsigned levels = depthLevels;
+    while (levels > 1 and depthHistogram[levels - 1] == 0)
+        --levels;
+
+    out << "Rays per recursion level:";
+    for (unsigned level = 0; level != levels; ++level)
+        out << ' ' << depthHistogram[level];
+    out << ".\n";
+
+    out << "Intersection tests:";
+    char const *separator = " ";
+    for (auto const &entry : namedIntersectionTests(*this))
+    {
+        out << separator << entry.second << ' ' << entry.first;
+        separator = ", ";
+    }
+    out << (intersectionTests.empty() ? " none.\n" : ".\n");
+}
+
+Statistics &Statistics::local()
+{
+    thread_local Statistics statistics;
+    return statistics;
+}
@@ -0,0 +1,56 @@
+#ifndef STATISTICS_H_
+#define STATISTICS_H_
+
+#include "json/json_fwd.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <typeindex>
+#include <unordered_map>
+
+class Object;
+
+// Counters describing the work done for a render. Counting is only compiled
+// in if RAYTRACER_STATISTICS is defined (see the CMake option of the same
+// name, the benchmark target always defines it), so that the hot paths of
+// regular builds stay untouched. Use as:
+//
+//     if (Statistics::enabled)
+//         ++Statistics::local().shadowRays;
+struct Statistics
+{
+#ifdef RAYTRACER_STATISTICS
+    static bool const enabled = true;
+#else
+    static bool const enabled = false;
+#endif
+
+    static unsigned const depthLevels = 8;
+
+    uint64_t primaryRays = 0;
+    uint64_t secondaryRays = 0;     // reflected and refracted rays
+    uint64_t shadowRays = 0;
+    uint64_t marchSteps = 0;        // summed over all ray marched objects
+    uint64_t coneMarchSteps = 0;    // of the cone marches before the rays, see Scene::marchStarts
+    uint64_t maxStepsExits = 0;     // marches that used up maxSteps without a hit
+    uint64_t refinedPixels = 0;     // by adaptive sampling
+
+    // Traced rays per recursion level, 0 being the primary rays. The last
+    // level also counts the deeper ones.
+    uint64_t depthHistogram[depthLevels] = {};
+
+    // Intersection and occlusion tests per object type.
+    std::unordered_map<std::type_index, uint64_t> intersectionTests;
+
+    void add(Statistics const &other);
+    void countIntersectionTest(Object const &object);
+
+    nlohmann::json toJson() const;
+    void print(std::ostream &out) const;
+
+    // Counters of the calling thread. Scene::render collects them after
+    // every tile, so they only need to be read through Scene::getStatistics.
+    static Statistics &local();
+};
+
+#endif
@@ -0,0 +1,182 @@
+#include "texture.h"
+
+#include "lode/lodepng.h"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <mutex>
+
+using namespace std;
+
+namespace
+{
+    // Side of the square blocks of texels, 4 x 4 texels of 4 bytes each are
+    // a cache line.
+    unsigned const blockSize = 4;
+
+    Color toColor(uint8_t const *rgba)
+    {
+        return Color(rgba[0] / 255.0, rgba[1] / 255.0, rgba[2] / 255.0);
+    }
+
+    // Index of coordinate in [0, size) repeating outside of it.
+    unsigned repeat(long coordinate, unsigned size)
+    {
+        long wrapped = coordinate % static_cast<long>(size);
+        return wrapped < 0 ? wrapped + size : wrapped;
+    }
+}
+
+TexturePtr Texture::load(string const &filename)
+{
+    // Textures stay cached while any material uses them. Different spellings
+    // of the same path share the texture.
+    static mutex cacheMutex;
+    static map<string, weak_ptr<Texture const>> cache;
+
+    error_code error;
+    string key = filesystem::weakly_canonical(filename, error).string();
+    if (error)
+        key = filename;
+
+    lock_guard<mutex> lock(cacheMutex);
+    if (TexturePtr cached = cache[key].lock())
+        return cached;
+
+    // Decoded without the alpha channel.
+    vector<uint8_t> rgb;
+    unsigned width;
+    unsigned height;
+    if (unsigned code = lodepng::decode(rgb, width, height, filename, LCT_RGB, 8))
+    {
+        cerr << "Error: could not read texture " << filename << ": "
+             << lodepng_error_text(code) << ".\n";
+        return nullptr;
+    }
+
+    TexturePtr texture(new Texture(rgb, width, height));
+    cache[key] = texture;
+    return texture;
+}
+
+Texture::Level::Level(unsigned width, unsigned height)
+:
+    width(width),
+    height(height),
+    blocksPerRow((width + blockSize - 1) / blockSize),
+    texels(4 * static_cast<size_t>(blocksPerRow) * blockSize
+             * ((height + blockSize - 1) / blockSize) * blockSize, 255)
+{}
+
+uint8_t *Texture::Level::texel(unsigned x, unsigned y)
+{
+    size_t block = static_cast<size_t>(y / blockSize) * blocksPerRow + x / blockSize;
+    size_t offset = (y % blockSize) * blockSize + x % blockSize;
+    return &texels[4 * (block * blockSize * blockSize + offset)];
+}
+
+uint8_t const *Texture::Level::texel(unsigned x, unsigned y) const
+{
+    return const_cast<Level *>(this)->texel(x, y);
+}
+
+Texture::Texture(vector<uint8_t> const &rgb, unsigned width, unsigned height)
+{
+    d_levels.emplace_back(width, height);
+    for (unsigned y = 0; y != height; ++y)
+    {
+        for (unsigned x = 0; x != width; ++x)
+            copy_n(&rgb[3 * (static_cast<size_t>(y) * width + x)], 3, d_levels[0].texel(x, y));
+    }
+
+    // Every texel of the next level averages 2 x 2 texels, the last row or
+    // column of odd sizes is repeated.
+    while (d_levels.back().width > 1 or d_levels.back().height > 1)
+    {
+        Level const &previous = d_levels.back();
+        Level next(max(previous.width / 2, 1u), max(previous.height / 2, 1u));
+        for (unsigned y = 0; y != next.height; ++y)
+        {
+            for (unsigned x = 0; x != next.width; ++x)
+            {
+                unsigned x0 = min(2 * x, previous.width - 1);
+                unsigned x1 = min(2 * x + 1, previous.width - 1);
+                unsigned y0 = min(2 * y, previous.height - 1);
+                unsigned y1 = min(2 * y + 1, previous.height - 1);
+                for (unsigned channel = 0; channel != 3; ++channel)
+                {
+                    unsigned sum = previous.texel(x0, y0)[channel] + previous.texel(x1, y0)[channel]
+                                 + previous.texel(x0, y1)[channel] + previous.texel(x1, y1)[channel];
+                    next.texel(x, y)[channel] = (sum + 2) / 4;
+                }
+            }
+        }
+        d_levels.push_back(move(next));
+    }
+}
+
+Color Texture::texel(unsigned x, unsigned y) const
+{
+    return toColor(d_levels[0].texel(x, y));
+}
+
+Color Texture::colorAt(float x, float y) const
+{
+    return texel(static_cast<unsigned>(x * (width() - 1)),
+                 static_cast<unsigned>(y * (height() - 1)));
+}
+
+Color Texture::sample(double u, double v, double footprint) const
+{
+    // The level whose texels are as wide as the footprint.
+    double level = log2(footprint * max(width(), height()));
+    if (not (level > 0.0))
+        return bilinear(d_levels[0], u, v);
+
+    unsigned lower = static_cast<unsigned>(level);
+    if (lower + 1 >= d_levels.size())
+        return bilinear(d_levels.back(), u, v);
+
+    double fraction = level - lower;
+    return (1.0 - fraction) * bilinear(d_levels[lower], u, v)
+           + fraction * bilinear(d_levels[lower + 1], u, v);
+}
+
+// Interpolates between the four texels around (u, v), with texel centers at
+// half integer positions.
+Color Texture::bilinear(Level const &level, double u, double v) const
+{
+    double x = u * level.width - 0.5;
+    double y = v * level.height - 0.5;
+    double xFloor = floor(x);
+    double yFloor = floor(y);
+    double xFraction = x - xFloor;
+    double yFraction = y - yFloor;
+
+    unsigned x0 = repeat(static_cast<long>(xFloor), level.width);
+    unsigned x1 = repeat(static_cast<long>(xFloor) + 1, level.width);
+    unsigned y0 = repeat(static_cast<long>(yFloor), level.height);
+    unsigned y1 = repeat(static_cast<long>(yFloor) + 1, level.height);
+
+    Color top = (1.0 - xFraction) * toColor(level.texel(x0, y0)) + xFraction * toColor(level.texel(x1, y0));
+    Color bottom = (1.0 - xFraction) * toColor(level.texel(x0, y1)) + xFraction * toColor(level.texel(x1, y1));
+    return (1.0 - yFraction) * top + yFraction * bottom;
+}
+
+unsigned Texture::width() const
+{
+    return d_levels[0].width;
+}
+
+unsigned Texture::height() const
+{
+    return d_levels[0].height;
+}
+
+unsigned Texture::levels() const
+{
+    return d_levels.size();
+}
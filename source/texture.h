@@ -0,0 +1,68 @@
+#ifndef TEXTURE_H_
+#define TEXTURE_H_
+
+#include "triple.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Texture;
+typedef std::shared_ptr<Texture const> TexturePtr;
+
+// An image used as a texture. Every file is decoded once and shared by all
+// materials using it, see load, so textures are immutable.
+//
+// A texture keeps a chain of mip levels, each half the size of the one
+// before, down to a single texel, for filtered sampling of textures that
+// are seen from afar (see sample). Texels are stored with 8 bits per
+// channel (the alpha channel is unused padding) in blocks of 4 x 4 texels,
+// so that a block fills one cache line and a bilinear lookup touches one or
+// two of them.
+class Texture
+{
+    struct Level
+    {
+        unsigned width;
+        unsigned height;
+        unsigned blocksPerRow;
+        std::vector<uint8_t> texels;    // rgba, in blocks row by row
+
+        Level(unsigned width, unsigned height);
+        uint8_t *texel(unsigned x, unsigned y);
+        uint8_t const *texel(unsigned x, unsigned y) const;
+    };
+
+    std::vector<Level> d_levels;    // the full resolution first
+
+    public:
+        // The texture of the PNG file, decoded on the first request for
+        // the path. Returns nullptr, and prints why, if it cannot be read.
+        static TexturePtr load(std::string const &filename);
+
+        // Texel of the full resolution level.
+        Color texel(unsigned x, unsigned y) const;
+
+        // Nearest texel of the full resolution level at normalized
+        // coordinates (0...1, 0...1), as Image::colorAt.
+        Color colorAt(float x, float y) const;
+
+        // Filtered color at texture coordinates (u, v), which repeat
+        // outside of (0...1, 0...1). The footprint is the width of the area
+        // to average in texture coordinates, it selects the two mip levels
+        // whose texels are closest in size, which are sampled bilinearly
+        // and interpolated (trilinear filtering). A footprint below a texel
+        // samples the full resolution level bilinearly.
+        Color sample(double u, double v, double footprint) const;
+
+        unsigned width() const;
+        unsigned height() const;
+        unsigned levels() const;
+
+    private:
+        Texture(std::vector<uint8_t> const &rgb, unsigned width, unsigned height);
+        Color bilinear(Level const &level, double u, double v) const;
+};
+
+#endif
@@ -0,0 +1,128 @@
+#include "tile_scheduler.h"
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+namespace
+{
+    // Tile indices owned by a single worker. The owner takes work from the
+    // back, thieves take work from the front so they rarely contend.
+    struct WorkQueue
+    {
+        mutex lock;
+        deque<unsigned> tiles;
+
+        bool pop(unsigned &tile)
+        {
+            lock_guard<mutex> guard(lock);
+            if (tiles.empty())
+                return false;
+            tile = tiles.back();
+            tiles.pop_back();
+            return true;
+        }
+
+        bool steal(unsigned &tile)
+        {
+            lock_guard<mutex> guard(lock);
+            if (tiles.empty())
+                return false;
+            tile = tiles.front();
+            tiles.pop_front();
+            return true;
+        }
+    };
+}
+
+TileScheduler::TileScheduler(unsigned width, unsigned height,
+                             unsigned tileSize, unsigned threadCount)
+:
+    d_tiles(),
+    d_threadCount(threadCount)
+{
+    if (tileSize == 0)
+        tileSize = 1;
+
+    for (unsigned y = 0; y < height; y += tileSize)
+    {
+        for (unsigned x = 0; x < width; x += tileSize)
+        {
+            Tile tile;
+            tile.index = d_tiles.size();
+            tile.x0 = x;
+            tile.y0 = y;
+            tile.x1 = min(x + tileSize, width);
+            tile.y1 = min(y + tileSize, height);
+            d_tiles.push_back(tile);
+        }
+    }
+
+    if (d_threadCount == 0)
+        d_threadCount = max(thread::hardware_concurrency(), 1u);
+
+    // More threads than tiles would only idle.
+    d_threadCount = max(min<unsigned>(d_threadCount, d_tiles.size()), 1u);
+}
+
+void TileScheduler::run(function<void(Tile const &, unsigned)> const &renderTile) const
+{
+    if (d_threadCount == 1)
+    {
+        for (Tile const &tile : d_tiles)
+            renderTile(tile, 0);
+        return;
+    }
+
+    // Hand every worker a contiguous band of tiles to keep neighbouring
+    // tiles (and their cache lines) on the same core as long as possible.
+    vector<unique_ptr<WorkQueue>> queues;
+    for (unsigned worker = 0; worker != d_threadCount; ++worker)
+        queues.emplace_back(new WorkQueue());
+
+    for (Tile const &tile : d_tiles)
+    {
+        size_t owner = static_cast<size_t>(tile.index) * d_threadCount / d_tiles.size();
+        queues[owner]->tiles.push_front(tile.index);
+    }
+
+    auto work = [&](unsigned worker)
+    {
+        unsigned tile;
+        while (true)
+        {
+            bool found = queues[worker]->pop(tile);
+            for (unsigned offset = 1; not found and offset != d_threadCount; ++offset)
+                found = queues[(worker + offset) % d_threadCount]->steal(tile);
+
+            // No tiles are added while running, so all queues being
+            // empty means we are done.
+            if (not found)
+                return;
+
+            renderTile(d_tiles[tile], worker);
+        }
+    };
+
+    vector<thread> threads;
+    for (unsigned worker = 1; worker != d_threadCount; ++worker)
+        threads.emplace_back(work, worker);
+    work(0);
+
+    for (thread &t : threads)
+        t.join();
+}
+
+vector<Tile> const &TileScheduler::tiles() const
+{
+    return d_tiles;
+}
+
+unsigned TileScheduler::threadCount() const
+{
+    return d_threadCount;
+}
@@ -0,0 +1,38 @@
+#ifndef TILE_SCHEDULER_H_
+#define TILE_SCHEDULER_H_
+
+#include <functional>
+#include <vector>
+
+// Rectangular block of pixels [x0, x1) x [y0, y1).
+struct Tile
+{
+    unsigned index;     // position in row-major tile order
+    unsigned x0;
+    unsigned y0;
+    unsigned x1;
+    unsigned y1;
+};
+
+// Splits an image into tiles and hands them to a pool of worker threads.
+// Every worker owns a queue of tiles and steals from the other queues
+// once its own queue runs dry.
+class TileScheduler
+{
+    std::vector<Tile> d_tiles;
+    unsigned d_threadCount;
+
+    public:
+        // A thread count of 0 selects the number of hardware threads.
+        TileScheduler(unsigned width, unsigned height,
+                      unsigned tileSize, unsigned threadCount);
+
+        // Calls renderTile(tile, worker) exactly once for every tile,
+        // where worker is in [0, threadCount()). Blocks until all tiles are done.
+        void run(std::function<void(Tile const &, unsigned)> const &renderTile) const;
+
+        std::vector<Tile> const &tiles() const;
+        unsigned threadCount() const;
+};
+
+#endif